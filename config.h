@@ -1,4 +1,5 @@
 #define  PULSEAUDIO_ENABLE 0
 #define  ALSA_ENABLE 0
 #define  PCAP_ENABLE 0
+#define  XDP_ENABLE 0
 #define  PACKAGE_PACKED 0
@@ -0,0 +1,299 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common/common.h"
+#include "convolver.h"
+#include "fft.h"
+#include "simd.h"
+
+struct convolver_channel {
+    fft_t *fft;
+    float *time, *res;
+    float *fdl_re, *fdl_im;
+    float *acc_re, *acc_im;
+    float *in, *out;
+    size_t fill;
+    size_t cur;
+};
+
+struct convolver {
+    size_t block, bins, parts, taps;
+    uint32_t channels;
+    float *h_re, *h_im;
+    struct convolver_channel *ch;
+};
+
+LOG_TAG_DECLR("dsp");
+
+static void channel_free(struct convolver_channel *s) {
+  fft_destroy(s->fft);
+  free(s->time);
+  free(s->res);
+  free(s->fdl_re);
+  free(s->fdl_im);
+  free(s->acc_re);
+  free(s->acc_im);
+  free(s->in);
+  free(s->out);
+}
+
+static int channel_init(struct convolver_channel *s, size_t block, size_t bins, size_t parts) {
+  s->fft = fft_create(block * 2);
+  s->time = calloc(block * 2, sizeof(float));
+  s->res = malloc(block * 2 * sizeof(float));
+  s->fdl_re = calloc(parts * bins, sizeof(float));
+  s->fdl_im = calloc(parts * bins, sizeof(float));
+  s->acc_re = malloc(bins * sizeof(float));
+  s->acc_im = malloc(bins * sizeof(float));
+  s->in = calloc(block, sizeof(float));
+  s->out = calloc(block, sizeof(float));
+  s->fill = 0;
+  s->cur = 0;
+
+  if (!s->fft || !s->time || !s->res || !s->fdl_re || !s->fdl_im || !s->acc_re || !s->acc_im || !s->in || !s->out) return -1;
+  return 0;
+}
+
+convolver_t *convolver_create(const float *taps, size_t len, size_t block, uint32_t channels) {
+  convolver_t *c;
+  fft_t *fft;
+  float *buf;
+  size_t p, k, n;
+  float scale;
+  uint32_t ch;
+
+  if (taps == NULL || len == 0 || len > CONVOLVER_MAX_TAPS || channels == 0) return NULL;
+  if (block == 0) block = CONVOLVER_BLOCK;
+
+  c = calloc(1, sizeof(convolver_t));
+  if (c == NULL) return NULL;
+
+  c->block = block;
+  c->bins = block + 1;
+  c->parts = (len + block - 1) / block;
+  c->taps = len;
+  c->channels = channels;
+  c->h_re = malloc(c->parts * c->bins * sizeof(float));
+  c->h_im = malloc(c->parts * c->bins * sizeof(float));
+  c->ch = calloc(channels, sizeof(struct convolver_channel));
+
+  fft = fft_create(block * 2);
+  buf = malloc(block * 2 * sizeof(float));
+  if (!c->h_re || !c->h_im || !c->ch || !fft || !buf) goto fail;
+
+  // 逆变换的 1/block 归一化提前乘到滤波器频谱里
+  scale = 1.0f / block;
+  for (p = 0; p < c->parts; p++) {
+    n = min(block, len - p * block);
+    memset(buf, 0, block * 2 * sizeof(float));
+    memcpy(buf, taps + p * block, n * sizeof(float));
+    fft_forward(fft, buf, c->h_re + p * c->bins, c->h_im + p * c->bins);
+    for (k = 0; k < c->bins; k++) {
+      c->h_re[p * c->bins + k] *= scale;
+      c->h_im[p * c->bins + k] *= scale;
+    }
+  }
+  fft_destroy(fft);
+  free(buf);
+
+  for (ch = 0; ch < channels; ch++) {
+    if (channel_init(&c->ch[ch], block, c->bins, c->parts) != 0) {
+      convolver_destroy(c);
+      return NULL;
+    }
+  }
+
+  LOGI("convolver %u taps, %u x %u partitions", (uint32_t) len, (uint32_t) c->parts, (uint32_t) block);
+  return c;
+
+fail:
+  fft_destroy(fft);
+  free(buf);
+  convolver_destroy(c);
+  return NULL;
+}
+
+void convolver_destroy(convolver_t *c) {
+  uint32_t ch;
+
+  if (c == NULL) return;
+
+  if (c->ch) {
+    for (ch = 0; ch < c->channels; ch++) channel_free(&c->ch[ch]);
+    free(c->ch);
+  }
+  free(c->h_re);
+  free(c->h_im);
+  free(c);
+}
+
+void convolver_reset(convolver_t *c) {
+  struct convolver_channel *s;
+  uint32_t ch;
+
+  for (ch = 0; ch < c->channels; ch++) {
+    s = &c->ch[ch];
+    memset(s->time, 0, c->block * 2 * sizeof(float));
+    memset(s->fdl_re, 0, c->parts * c->bins * sizeof(float));
+    memset(s->fdl_im, 0, c->parts * c->bins * sizeof(float));
+    memset(s->in, 0, c->block * sizeof(float));
+    memset(s->out, 0, c->block * sizeof(float));
+    s->fill = 0;
+    s->cur = 0;
+  }
+}
+
+size_t convolver_tail(const convolver_t *c) {
+  return c->taps + c->block;
+}
+
+static void convolver_block(const convolver_t *c, struct convolver_channel *s) {
+  size_t block = c->block, bins = c->bins, p, slot;
+
+  memcpy(s->time + block, s->in, block * sizeof(float));
+  fft_forward(s->fft, s->time, s->fdl_re + s->cur * bins, s->fdl_im + s->cur * bins);
+  memcpy(s->time, s->in, block * sizeof(float));
+
+  memset(s->acc_re, 0, bins * sizeof(float));
+  memset(s->acc_im, 0, bins * sizeof(float));
+  for (p = 0; p < c->parts; p++) {
+    slot = (s->cur + c->parts - p) % c->parts;
+    simd_cmac(s->acc_re, s->acc_im, s->fdl_re + slot * bins, s->fdl_im + slot * bins, c->h_re + p * bins,
+              c->h_im + p * bins, bins);
+  }
+  s->cur = (s->cur + 1) % c->parts;
+
+  // 前一半是循环卷积的混叠部分，结果只取后一半
+  fft_inverse(s->fft, s->acc_re, s->acc_im, s->res);
+  memcpy(s->out, s->res + block, block * sizeof(float));
+}
+
+void convolver_process_channel(convolver_t *c, uint32_t ch, float *data, size_t frames) {
+  struct convolver_channel *s = &c->ch[ch];
+  size_t i = 0, n, k;
+  float v;
+
+  while (i < frames) {
+    n = min(frames - i, c->block - s->fill);
+    for (k = 0; k < n; k++) {
+      v = data[i + k];
+      data[i + k] = s->out[s->fill + k];
+      s->in[s->fill + k] = v;
+    }
+    s->fill += n;
+    i += n;
+
+    if (s->fill == c->block) {
+      convolver_block(c, s);
+      s->fill = 0;
+    }
+  }
+}
+
+void convolver_process(convolver_t *c, float *const *data, size_t frames) {
+  uint32_t ch;
+
+  for (ch = 0; ch < c->channels; ch++) convolver_process_channel(c, ch, data[ch], frames);
+}
+
+float *fir_load_file(const char *path, size_t *len, uint32_t *rate) {
+  char line[128], *end;
+  float *taps, v;
+  size_t n = 0;
+  unsigned int hz;
+  FILE *fp;
+
+  *rate = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    LOGE("open fir %s error: %m", path);
+    return NULL;
+  }
+
+  taps = malloc(CONVOLVER_MAX_TAPS * sizeof(float));
+  if (taps == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == '#') {
+      if (sscanf(line, "# rate %u", &hz) == 1) *rate = hz;
+      continue;
+    }
+    v = strtof(line, &end);
+    if (end == line) continue;
+    if (n >= CONVOLVER_MAX_TAPS) {
+      LOGW("fir %s longer than %d taps, truncated", path, CONVOLVER_MAX_TAPS);
+      break;
+    }
+    taps[n++] = v;
+  }
+  fclose(fp);
+
+  if (n == 0) {
+    LOGE("fir %s is empty", path);
+    free(taps);
+    return NULL;
+  }
+
+  *len = n;
+  return taps;
+}
+
+double convolver_bench(size_t taps, uint32_t rate, size_t block) {
+  struct timespec t0, t1;
+  convolver_t *c;
+  float *h, *x;
+  size_t i, frames = rate * 2;
+  double cost;
+
+  h = malloc(taps * sizeof(float));
+  x = malloc(frames * sizeof(float));
+  if (h == NULL || x == NULL) {
+    free(h);
+    free(x);
+    return 0;
+  }
+  for (i = 0; i < taps; i++) h[i] = (float) rand() / RAND_MAX - 0.5f;
+  for (i = 0; i < frames; i++) x[i] = (float) rand() / RAND_MAX - 0.5f;
+
+  c = convolver_create(h, taps, block, 1);
+  if (c == NULL) {
+    free(h);
+    free(x);
+    return 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  convolver_process_channel(c, 0, x, frames);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  convolver_destroy(c);
+  free(h);
+  free(x);
+
+  cost = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  return cost > 0 ? 2.0 / cost : 0;
+}
@@ -0,0 +1,73 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_CONVOLVER_H
+#define DSP_CONVOLVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#define CONVOLVER_BLOCK 64
+#define CONVOLVER_MAX_TAPS 4096
+#else
+#define CONVOLVER_BLOCK 128
+#define CONVOLVER_MAX_TAPS 65536
+#endif
+
+typedef struct convolver convolver_t;
+
+/**
+ * 均匀分块的 overlap-save 频域卷积，每块 block 个采样，延迟为 block 个采样。
+ * 所有声道使用同一个滤波器
+ */
+convolver_t *convolver_create(const float *taps, size_t len, size_t block, uint32_t channels);
+
+void convolver_destroy(convolver_t *c);
+
+/**
+ * 清空延迟线，长时间静音后使用，避免恢复播放时输出旧的尾音
+ */
+void convolver_reset(convolver_t *c);
+
+/**
+ * 按声道分开的数据原位处理，frames 任意
+ */
+void convolver_process(convolver_t *c, float *const *data, size_t frames);
+
+/**
+ * 只处理一个声道，不同声道可以在不同线程中同时调用
+ */
+void convolver_process_channel(convolver_t *c, uint32_t ch, float *data, size_t frames);
+
+size_t convolver_tail(const convolver_t *c);
+
+/**
+ * 读取文本格式的滤波器系数，每行一个，# 开头为注释。"# rate <hz>" 注释给出滤波器的采样率
+ * @param rate 没有 rate 注释时为 0
+ * @return 系数数组，由调用者 free
+ */
+float *fir_load_file(const char *path, size_t *len, uint32_t *rate);
+
+/**
+ * 测量单核在 rate 采样率下可以实时处理多少个 taps 长度的声道
+ */
+double convolver_bench(size_t taps, uint32_t rate, size_t block);
+
+#endif
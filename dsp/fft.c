@@ -0,0 +1,163 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <math.h>
+#include "fft.h"
+
+struct fft {
+    size_t n, m;
+    uint32_t *bitrev;
+    float *cos_m, *sin_m;
+    float *cos_n, *sin_n;
+    float *zr, *zi;
+};
+
+fft_t *fft_create(size_t n) {
+  fft_t *f;
+  size_t k, m = n / 2, bits = 0, j, b;
+
+  if (n < 4 || (n & (n - 1))) return NULL;
+
+  f = calloc(1, sizeof(fft_t));
+  if (f == NULL) return NULL;
+
+  f->n = n;
+  f->m = m;
+  f->bitrev = malloc(m * sizeof(uint32_t));
+  f->cos_m = malloc(m / 2 * sizeof(float));
+  f->sin_m = malloc(m / 2 * sizeof(float));
+  f->cos_n = malloc((m + 1) * sizeof(float));
+  f->sin_n = malloc((m + 1) * sizeof(float));
+  f->zr = malloc(m * sizeof(float));
+  f->zi = malloc(m * sizeof(float));
+  if (!f->bitrev || !f->cos_m || !f->sin_m || !f->cos_n || !f->sin_n || !f->zr || !f->zi) {
+    fft_destroy(f);
+    return NULL;
+  }
+
+  while (((size_t) 1 << bits) < m) bits++;
+  for (k = 0; k < m; k++) {
+    for (j = 0, b = 0; b < bits; b++) j |= ((k >> b) & 1) << (bits - 1 - b);
+    f->bitrev[k] = (uint32_t) j;
+  }
+  for (k = 0; k < m / 2; k++) {
+    f->cos_m[k] = (float) cos(2 * M_PI * k / m);
+    f->sin_m[k] = (float) -sin(2 * M_PI * k / m);
+  }
+  for (k = 0; k <= m; k++) {
+    f->cos_n[k] = (float) cos(2 * M_PI * k / n);
+    f->sin_n[k] = (float) -sin(2 * M_PI * k / n);
+  }
+
+  return f;
+}
+
+void fft_destroy(fft_t *f) {
+  if (f == NULL) return;
+
+  free(f->bitrev);
+  free(f->cos_m);
+  free(f->sin_m);
+  free(f->cos_n);
+  free(f->sin_n);
+  free(f->zr);
+  free(f->zi);
+  free(f);
+}
+
+/**
+ * 原位 radix-2 DIT，输入已按位反序排列。inverse 时使用共轭旋转因子
+ */
+static void fft_complex(const fft_t *f, float *re, float *im, int inverse) {
+  size_t m = f->m, len, half, step, i, k;
+  float wr, wi, tr, ti;
+
+  for (len = 2; len <= m; len <<= 1) {
+    half = len >> 1;
+    step = m / len;
+    for (i = 0; i < m; i += len) {
+      for (k = 0; k < half; k++) {
+        wr = f->cos_m[k * step];
+        wi = inverse ? -f->sin_m[k * step] : f->sin_m[k * step];
+        tr = re[i + k + half] * wr - im[i + k + half] * wi;
+        ti = re[i + k + half] * wi + im[i + k + half] * wr;
+        re[i + k + half] = re[i + k] - tr;
+        im[i + k + half] = im[i + k] - ti;
+        re[i + k] += tr;
+        im[i + k] += ti;
+      }
+    }
+  }
+}
+
+void fft_forward(fft_t *f, const float *in, float *re, float *im) {
+  size_t m = f->m, k;
+  float *zr = f->zr, *zi = f->zi;
+  float er, ei, or, oi, wr, wi;
+
+  for (k = 0; k < m; k++) {
+    zr[f->bitrev[k]] = in[2 * k];
+    zi[f->bitrev[k]] = in[2 * k + 1];
+  }
+  fft_complex(f, zr, zi, 0);
+
+  re[0] = zr[0] + zi[0];
+  im[0] = 0;
+  re[m] = zr[0] - zi[0];
+  im[m] = 0;
+  for (k = 1; k < m; k++) {
+    // 偶数/奇数序列的频谱
+    er = 0.5f * (zr[k] + zr[m - k]);
+    ei = 0.5f * (zi[k] - zi[m - k]);
+    or = 0.5f * (zi[k] + zi[m - k]);
+    oi = -0.5f * (zr[k] - zr[m - k]);
+    wr = f->cos_n[k];
+    wi = f->sin_n[k];
+    re[k] = er + or * wr - oi * wi;
+    im[k] = ei + or * wi + oi * wr;
+  }
+}
+
+void fft_inverse(fft_t *f, const float *re, const float *im, float *out) {
+  size_t m = f->m, k, j;
+  float *zr = f->zr, *zi = f->zi;
+  float er, ei, dr, di, or, oi, wr, wi;
+
+  for (k = 0; k < m; k++) {
+    er = 0.5f * (re[k] + re[m - k]);
+    ei = 0.5f * (im[k] - im[m - k]);
+    dr = 0.5f * (re[k] - re[m - k]);
+    di = 0.5f * (im[k] + im[m - k]);
+    // 除以旋转因子即乘以其共轭
+    wr = f->cos_n[k];
+    wi = -f->sin_n[k];
+    or = dr * wr - di * wi;
+    oi = dr * wi + di * wr;
+    j = f->bitrev[k];
+    zr[j] = er - oi;
+    zi[j] = ei + or;
+  }
+  fft_complex(f, zr, zi, 1);
+
+  for (k = 0; k < m; k++) {
+    out[2 * k] = zr[k];
+    out[2 * k + 1] = zi[k];
+  }
+}
@@ -0,0 +1,43 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_FFT_H
+#define DSP_FFT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct fft fft_t;
+
+/**
+ * 长度为 n 的实数 FFT，n 为 2 的幂，内部用 n/2 点复数 FFT 实现。
+ * 频域为分离的实部/虚部数组，各 n/2+1 个点
+ */
+fft_t *fft_create(size_t n);
+
+void fft_destroy(fft_t *f);
+
+void fft_forward(fft_t *f, const float *in, float *re, float *im);
+
+/**
+ * 逆变换不做归一化，输出为原信号的 n/2 倍
+ */
+void fft_inverse(fft_t *f, const float *re, const float *im, float *out);
+
+#endif
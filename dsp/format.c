@@ -0,0 +1,206 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include <math.h>
+#include "format.h"
+
+#define S16_SCALE (1.0f / 32768.0f)
+#define S24_SCALE (1.0f / 8388608.0f)
+#define S32_SCALE (1.0f / 2147483648.0f)
+
+static inline int32_t load_s24(const uint8_t *p) {
+  return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8;
+}
+
+static inline void store_s24(uint8_t *p, int32_t v) {
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+  p[2] = (uint8_t) (v >> 16);
+}
+
+static inline int32_t clamp_scale(float v, float scale, int32_t lo, int32_t hi) {
+  float s = v * scale;
+  if (s >= (float) hi) return hi;
+  if (s <= (float) lo) return lo;
+  return (int32_t) lrintf(s);
+}
+
+static inline __attribute__((always_inline)) float load_sample(const uint8_t *p, int bits) {
+  int16_t s16;
+  int32_t s32;
+
+  switch (bits) {
+    case 16:
+      memcpy(&s16, p, sizeof(s16));
+      return (float) s16 * S16_SCALE;
+    case 24:
+      return (float) load_s24(p) * S24_SCALE;
+    default:
+      memcpy(&s32, p, sizeof(s32));
+      return (float) s32 * S32_SCALE;
+  }
+}
+
+static inline __attribute__((always_inline)) void
+decode_channel(float *dst, const uint8_t *p, size_t frames, size_t stride, int bits) {
+  size_t i;
+
+  for (i = 0; i < frames; i++, p += stride) dst[i] = load_sample(p, bits);
+}
+
+/**
+ * 交错的整数 PCM 逐声道转换为连续的 float，电平统计在连续的 float 上用 SIMD 完成。
+ * 只统计电平时按 METER_BLOCK 分块转换到栈上。dst 或 m 为 NULL 时对应的部分被编译器消除
+ */
+static inline __attribute__((always_inline)) void
+decode(float *const *dst, const uint8_t *src, size_t frames, uint32_t channels, int bits, meter_t *m) {
+  size_t i, n, width = bits / 8, stride = channels * width;
+  float block[METER_BLOCK];
+  const uint8_t *p;
+  uint32_t ch;
+
+  for (ch = 0; ch < channels; ch++) {
+    p = src + ch * width;
+    if (dst) {
+      decode_channel(dst[ch], p, frames, stride, bits);
+      if (m) meter_block(m, ch, dst[ch], frames);
+    } else if (m && ch < m->channels) {
+      for (i = 0; i < frames; i += n) {
+        n = frames - i < METER_BLOCK ? frames - i : METER_BLOCK;
+        decode_channel(block, p + i * stride, n, stride, bits);
+        meter_block(m, ch, block, n);
+      }
+    }
+  }
+  if (m) m->frames += frames;
+}
+
+#define DECODE_DISPATCH(dst, src, frames, channels, bits, m)  \
+  switch (bits) {                                             \
+    case 16:                                                  \
+      decode(dst, src, frames, channels, 16, m);              \
+      return 0;                                               \
+    case 24:                                                  \
+      decode(dst, src, frames, channels, 24, m);              \
+      return 0;                                               \
+    case 32:                                                  \
+      decode(dst, src, frames, channels, 32, m);              \
+      return 0;                                               \
+    default:                                                  \
+      return -1;                                              \
+  }
+
+int pcm_to_float(float *const *dst, const uint8_t *src, size_t frames, uint32_t channels, int bits) {
+  DECODE_DISPATCH(dst, src, frames, channels, bits, NULL)
+}
+
+int pcm_to_float_meter(float *const *dst, const uint8_t *src, size_t frames, uint32_t channels, int bits,
+                       meter_t *m) {
+  DECODE_DISPATCH(dst, src, frames, channels, bits, m)
+}
+
+int pcm_meter(const uint8_t *src, size_t frames, uint32_t channels, int bits, meter_t *m) {
+  DECODE_DISPATCH(NULL, src, frames, channels, bits, m)
+}
+
+int pcm_channel_to_float(float *dst, const uint8_t *src, size_t frames, uint32_t channels, uint32_t ch, int bits) {
+  size_t width = bits / 8;
+
+  switch (bits) {
+    case 16:
+      decode_channel(dst, src + ch * width, frames, channels * width, 16);
+      return 0;
+    case 24:
+      decode_channel(dst, src + ch * width, frames, channels * width, 24);
+      return 0;
+    case 32:
+      decode_channel(dst, src + ch * width, frames, channels * width, 32);
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+int float_to_pcm_channel(uint8_t *dst, const float *src, size_t frames, uint32_t channels, uint32_t ch, int bits) {
+  size_t i, width = bits / 8, stride = channels * width;
+  int16_t s16;
+  int32_t s32;
+
+  dst += ch * width;
+  switch (bits) {
+    case 16:
+      for (i = 0; i < frames; i++, dst += stride) {
+        s16 = (int16_t) clamp_scale(src[i], 32768.0f, INT16_MIN, INT16_MAX);
+        memcpy(dst, &s16, sizeof(s16));
+      }
+      break;
+    case 24:
+      for (i = 0; i < frames; i++, dst += stride) store_s24(dst, clamp_scale(src[i], 8388608.0f, -8388608, 8388607));
+      break;
+    case 32:
+      for (i = 0; i < frames; i++, dst += stride) {
+        s32 = clamp_scale(src[i], 2147483648.0f, INT32_MIN, 2147483520);
+        memcpy(dst, &s32, sizeof(s32));
+      }
+      break;
+    default:
+      return -1;
+  }
+
+  return 0;
+}
+
+int float_to_pcm(uint8_t *dst, const float *const *src, size_t frames, uint32_t channels, int bits) {
+  size_t i;
+  uint32_t ch;
+  int16_t s16;
+  int32_t s32;
+
+  switch (bits) {
+    case 16:
+      for (i = 0; i < frames; i++) {
+        for (ch = 0; ch < channels; ch++, dst += 2) {
+          s16 = (int16_t) clamp_scale(src[ch][i], 32768.0f, INT16_MIN, INT16_MAX);
+          memcpy(dst, &s16, sizeof(s16));
+        }
+      }
+      break;
+    case 24:
+      for (i = 0; i < frames; i++) {
+        for (ch = 0; ch < channels; ch++, dst += 3) {
+          store_s24(dst, clamp_scale(src[ch][i], 8388608.0f, -8388608, 8388607));
+        }
+      }
+      break;
+    case 32:
+      for (i = 0; i < frames; i++) {
+        for (ch = 0; ch < channels; ch++, dst += 4) {
+          /* float 无法精确表示 INT32_MAX，截断到最近的可表示值 */
+          s32 = clamp_scale(src[ch][i], 2147483648.0f, INT32_MIN, 2147483520);
+          memcpy(dst, &s32, sizeof(s32));
+        }
+      }
+      break;
+    default:
+      return -1;
+  }
+
+  return 0;
+}
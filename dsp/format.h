@@ -0,0 +1,58 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_FORMAT_H
+#define DSP_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "meter.h"
+
+/**
+ * 交错的小端整数 PCM 转换为按声道分开的 float，范围 [-1, 1)
+ */
+int pcm_to_float(float *const *dst, const uint8_t *src, size_t frames, uint32_t channels, int bits);
+
+/**
+ * 同 pcm_to_float，同时统计每个声道的 peak/RMS/削波
+ */
+int pcm_to_float_meter(float *const *dst, const uint8_t *src, size_t frames, uint32_t channels, int bits,
+                       meter_t *m);
+
+/**
+ * 只统计电平，用于不需要转换的直通路径
+ */
+int pcm_meter(const uint8_t *src, size_t frames, uint32_t channels, int bits, meter_t *m);
+
+/**
+ * 按声道分开的 float 转换为交错的小端整数 PCM，超出范围的采样被截断
+ */
+int float_to_pcm(uint8_t *dst, const float *const *src, size_t frames, uint32_t channels, int bits);
+
+/**
+ * 只转换交错 PCM 中的声道 ch，不同线程可以同时转换不同的声道
+ */
+int pcm_channel_to_float(float *dst, const uint8_t *src, size_t frames, uint32_t channels, uint32_t ch, int bits);
+
+/**
+ * 只写入交错 PCM 中的声道 ch，不同线程可以同时写入不同的声道
+ */
+int float_to_pcm_channel(uint8_t *dst, const float *src, size_t frames, uint32_t channels, uint32_t ch, int bits);
+
+#endif
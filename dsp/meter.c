@@ -0,0 +1,57 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include <math.h>
+#include "meter.h"
+#include "simd.h"
+
+static inline float to_db(double v) {
+  return v > 0 ? fmaxf(20.0f * (float) log10(v), METER_FLOOR_DB) : METER_FLOOR_DB;
+}
+
+void meter_reset(meter_t *m, uint32_t channels) {
+  memset(m, 0, sizeof(meter_t));
+  m->channels = channels > METER_MAX_CHANNELS ? METER_MAX_CHANNELS : channels;
+}
+
+void meter_block(meter_t *m, uint32_t ch, const float *x, size_t n) {
+  float peak = 0, sum = 0;
+  uint32_t clips = 0;
+
+  if (ch >= m->channels) return;
+
+  simd_peak_power(x, n, METER_CLIP_LEVEL, &peak, &sum, &clips);
+  meter_add(m, ch, peak, sum, clips);
+}
+
+void meter_read(meter_t *m, struct meter_levels *levels) {
+  uint32_t ch;
+
+  levels->channels = m->channels;
+  for (ch = 0; ch < m->channels; ch++) {
+    levels->peak[ch] = to_db(m->peak[ch]);
+    levels->rms[ch] = m->frames ? to_db(sqrt(m->sum[ch] / m->frames)) : METER_FLOOR_DB;
+    levels->clips[ch] = m->clips[ch];
+
+    m->peak[ch] = 0;
+    m->sum[ch] = 0;
+  }
+  m->frames = 0;
+}
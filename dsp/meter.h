@@ -0,0 +1,65 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_METER_H
+#define DSP_METER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define METER_MAX_CHANNELS 17
+#define METER_CLIP_LEVEL 0.99997f
+#define METER_FLOOR_DB (-120.0f)
+/* 直通路径只统计电平时每次转换的帧数 */
+#define METER_BLOCK 256
+
+typedef struct {
+    uint32_t channels;
+    uint64_t frames;
+    float peak[METER_MAX_CHANNELS];
+    double sum[METER_MAX_CHANNELS];
+    uint32_t clips[METER_MAX_CHANNELS];
+} meter_t;
+
+struct meter_levels {
+    uint32_t channels;
+    float peak[METER_MAX_CHANNELS];
+    float rms[METER_MAX_CHANNELS];
+    uint32_t clips[METER_MAX_CHANNELS];
+};
+
+void meter_reset(meter_t *m, uint32_t channels);
+
+static inline void meter_add(meter_t *m, uint32_t ch, float peak, float sum, uint32_t clips) {
+  if (peak > m->peak[ch]) m->peak[ch] = peak;
+  m->sum[ch] += sum;
+  m->clips[ch] += clips;
+}
+
+/**
+ * 统计一个声道上连续的 n 个 float 采样，不计入 frames
+ */
+void meter_block(meter_t *m, uint32_t ch, const float *x, size_t n);
+
+/**
+ * 计算这一段时间内的 peak/RMS（dBFS），清空累计值，削波计数保持累加
+ */
+void meter_read(meter_t *m, struct meter_levels *levels);
+
+#endif
@@ -0,0 +1,273 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "common/common.h"
+#include "resample.h"
+#include "simd.h"
+
+#define RESAMPLE_TABLE_MAX 8
+#define RESAMPLE_KAISER_BETA 8.6
+/* β 对应的阻带衰减 dB */
+#define RESAMPLE_KAISER_ATTEN (RESAMPLE_KAISER_BETA / 0.1102 + 8.7)
+
+struct resample_table {
+    uint32_t up, down;
+    uint32_t taps;
+    float *coef;
+};
+
+struct resampler {
+    const struct resample_table *table;
+    uint32_t channels;
+    uint32_t up, down, taps;
+    uint32_t step_int, step_frac;
+    uint32_t pos_int, pos_frac;
+    size_t max_frames;
+    float **buf;
+};
+
+static struct resample_table tables[RESAMPLE_TABLE_MAX] = {0};
+static pthread_mutex_t tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+LOG_TAG_DECLR("dsp");
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+  uint32_t t;
+  while (b) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static double bessel_i0(double x) {
+  double sum = 1.0, term = 1.0, q = x * x / 4.0;
+  int k;
+  for (k = 1; k < 32; k++) {
+    term *= q / ((double) k * k);
+    sum += term;
+    if (term < sum * 1e-12) break;
+  }
+  return sum;
+}
+
+/**
+ * 降采样时截止频率跟随输出采样率，覆盖同样的输出样本数需要的输入抽头按抽取比例增加
+ */
+static uint32_t resample_taps(uint32_t up, uint32_t down) {
+  uint64_t taps = RESAMPLE_TAPS;
+
+  if (down > up) taps = ((uint64_t) RESAMPLE_TAPS * down + up - 1) / up;
+  taps = (taps + 7) & ~(uint64_t) 7;
+
+  return taps > RESAMPLE_MAX_TAPS ? RESAMPLE_MAX_TAPS : (uint32_t) taps;
+}
+
+/**
+ * Kaiser 窗 sinc 原型滤波器，拆分为 up 个相位，每个相位的系数逆序存放，
+ * 便于直接与历史样本做点积。
+ * 过渡带宽由抽头数决定，截止频率放在过渡带中间，使阻带正好从较低一侧的奈奎斯特频率开始
+ */
+static int table_build(struct resample_table *t, uint32_t up, uint32_t down, uint32_t taps) {
+  uint32_t n = up * taps, k, p, j;
+  double ratio = up < down ? (double) up / down : 1.0;
+  double transition = (RESAMPLE_KAISER_ATTEN - 7.95) / (14.36 * taps * ratio);
+  double fc = (0.5 - transition / 2) * ratio / up;
+  double center = (n - 1) / 2.0, m, w, h, i0b = bessel_i0(RESAMPLE_KAISER_BETA);
+
+  t->coef = aligned_alloc(32, n * sizeof(float));
+  if (t->coef == NULL) return -1;
+
+  for (k = 0; k < n; k++) {
+    m = k - center;
+    h = m == 0 ? 2 * fc : sin(2 * M_PI * fc * m) / (M_PI * m);
+    w = bessel_i0(RESAMPLE_KAISER_BETA * sqrt(1.0 - pow(2.0 * k / (n - 1) - 1.0, 2))) / i0b;
+    p = k % up;
+    j = k / up;
+    t->coef[p * taps + (taps - 1 - j)] = (float) (h * w * up);
+  }
+
+  t->up = up;
+  t->down = down;
+  t->taps = taps;
+  return 0;
+}
+
+static const struct resample_table *table_get(uint32_t up, uint32_t down, uint32_t taps) {
+  struct resample_table *t = NULL;
+  int i;
+
+  pthread_mutex_lock(&tables_mutex);
+  for (i = 0; i < RESAMPLE_TABLE_MAX; i++) {
+    if (tables[i].coef && tables[i].up == up && tables[i].down == down && tables[i].taps == taps) {
+      t = &tables[i];
+      break;
+    }
+    if (t == NULL && tables[i].coef == NULL) t = &tables[i];
+  }
+  if (t && t->coef == NULL && table_build(t, up, down, taps) != 0) t = NULL;
+  pthread_mutex_unlock(&tables_mutex);
+
+  if (t == NULL) LOGE("resample table %u/%u unavailable", up, down);
+  return t;
+}
+
+resampler_t *resampler_create(uint32_t in_rate, uint32_t out_rate, uint32_t channels, size_t max_frames) {
+  resampler_t *r;
+  uint32_t g, ch;
+
+  if (in_rate == 0 || out_rate == 0 || channels == 0) return NULL;
+
+  g = gcd(in_rate, out_rate);
+
+  r = calloc(1, sizeof(resampler_t));
+  if (r == NULL) return NULL;
+
+  r->up = out_rate / g;
+  r->down = in_rate / g;
+  r->taps = resample_taps(r->up, r->down);
+  r->step_int = r->down / r->up;
+  r->step_frac = r->down % r->up;
+  r->channels = channels;
+  r->max_frames = max_frames;
+
+  r->table = table_get(r->up, r->down, r->taps);
+  r->buf = calloc(channels, sizeof(float *));
+  if (r->table == NULL || r->buf == NULL) goto fail;
+
+  for (ch = 0; ch < channels; ch++) {
+    r->buf[ch] = aligned_alloc(32, ((r->taps + max_frames + 7) & ~(size_t) 7) * sizeof(float));
+    if (r->buf[ch] == NULL) goto fail;
+  }
+  resampler_reset(r);
+
+  LOGI("resampler %u -> %u (%u/%u), %u taps", in_rate, out_rate, r->up, r->down, r->taps);
+  return r;
+
+fail:
+  resampler_destroy(r);
+  return NULL;
+}
+
+void resampler_destroy(resampler_t *r) {
+  uint32_t ch;
+
+  if (r == NULL) return;
+
+  if (r->buf) {
+    for (ch = 0; ch < r->channels; ch++) free(r->buf[ch]);
+    free(r->buf);
+  }
+  free(r);
+}
+
+static void resampler_reset_history(resampler_t *r) {
+  uint32_t ch;
+
+  for (ch = 0; ch < r->channels; ch++) memset(r->buf[ch], 0, (r->taps - 1) * sizeof(float));
+}
+
+void resampler_reset(resampler_t *r) {
+  r->pos_int = 0;
+  r->pos_frac = 0;
+  resampler_reset_history(r);
+}
+
+size_t resampler_max_output(const resampler_t *r, size_t frames) {
+  return (size_t) (((uint64_t) frames * r->up + r->down - 1) / r->down) + 1;
+}
+
+/**
+ * 每个声道的历史只由处理该声道的线程访问，相位在所有声道处理完之后统一推进
+ */
+size_t resampler_process_channel(resampler_t *r, uint32_t ch, float *out, const float *in, size_t frames) {
+  const float *coef = r->table->coef;
+  uint32_t i = r->pos_int, p = r->pos_frac, taps = r->taps;
+  float *buf = r->buf[ch];
+  size_t n = 0;
+
+  if (frames > r->max_frames) frames = r->max_frames;
+
+  memcpy(buf + taps - 1, in, frames * sizeof(float));
+
+  while (i < frames) {
+    out[n++] = simd_dot(coef + p * taps, buf + i, taps);
+    i += r->step_int;
+    p += r->step_frac;
+    if (p >= r->up) {
+      p -= r->up;
+      i++;
+    }
+  }
+
+  memmove(buf, buf + frames, (taps - 1) * sizeof(float));
+  return n;
+}
+
+size_t resampler_advance(resampler_t *r, size_t frames) {
+  uint32_t i = r->pos_int, p = r->pos_frac;
+  size_t n = 0;
+
+  if (frames > r->max_frames) frames = r->max_frames;
+
+  while (i < frames) {
+    n++;
+    i += r->step_int;
+    p += r->step_frac;
+    if (p >= r->up) {
+      p -= r->up;
+      i++;
+    }
+  }
+  r->pos_int = i - frames;
+  r->pos_frac = p;
+
+  return n;
+}
+
+size_t resampler_process(resampler_t *r, float *const *out, const float *const *in, size_t frames) {
+  uint32_t ch;
+
+  for (ch = 0; ch < r->channels; ch++) resampler_process_channel(r, ch, out[ch], in[ch], frames);
+
+  return resampler_advance(r, frames);
+}
+
+size_t resampler_skip(resampler_t *r, size_t frames) {
+  size_t n = resampler_advance(r, frames);
+
+  resampler_reset_history(r);
+  return n;
+}
+
+void resample_tables_free() {
+  int i;
+
+  pthread_mutex_lock(&tables_mutex);
+  for (i = 0; i < RESAMPLE_TABLE_MAX; i++) {
+    free(tables[i].coef);
+    tables[i].coef = NULL;
+  }
+  pthread_mutex_unlock(&tables_mutex);
+}
@@ -0,0 +1,81 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_RESAMPLE_H
+#define DSP_RESAMPLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 每个相位的抽头数，以较低一侧的采样率计，降采样时按抽取比例增加到最多 RESAMPLE_MAX_TAPS。
+ * 实测（Kaiser β=8.6）：
+ *   128 抽头，通带 0.1dB 内到 20.4kHz(44.1k)/22.2kHz(48k)，奈奎斯特频率以上衰减 >= 85dB
+ *   48 抽头（ESP32），通带 0.1dB 内到 17.7kHz(44.1k)/19.2kHz(48k)，衰减 >= 81dB
+ */
+#ifdef ESP_PLATFORM
+#define RESAMPLE_TAPS 48
+#define RESAMPLE_MAX_TAPS 224
+#else
+#define RESAMPLE_TAPS 128
+#define RESAMPLE_MAX_TAPS 640
+#endif
+
+typedef struct resampler resampler_t;
+
+/**
+ * 固定比例的多相重采样，滤波器系数按 in_rate/out_rate 的最简比例预先计算并缓存
+ * @param max_frames 单次 resampler_process 输入的最大帧数
+ */
+resampler_t *resampler_create(uint32_t in_rate, uint32_t out_rate, uint32_t channels, size_t max_frames);
+
+void resampler_destroy(resampler_t *r);
+
+void resampler_reset(resampler_t *r);
+
+size_t resampler_max_output(const resampler_t *r, size_t frames);
+
+/**
+ * 输入输出均为按声道分开的 float
+ * @return 输出的帧数
+ */
+size_t resampler_process(resampler_t *r, float *const *out, const float *const *in, size_t frames);
+
+/**
+ * 只处理一个声道，不推进相位，可以在不同线程中处理不同的声道。
+ * 所有声道处理完之后调用 resampler_advance
+ * @return 输出的帧数，与 resampler_advance 的返回值相同
+ */
+size_t resampler_process_channel(resampler_t *r, uint32_t ch, float *out, const float *in, size_t frames);
+
+/**
+ * 按输入的帧数推进相位
+ * @return 对应的输出帧数
+ */
+size_t resampler_advance(resampler_t *r, size_t frames);
+
+/**
+ * 输入为静音时跳过计算，只推进相位并清空历史
+ * @return 对应的输出帧数
+ */
+size_t resampler_skip(resampler_t *r, size_t frames);
+
+void resample_tables_free();
+
+#endif
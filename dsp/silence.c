@@ -0,0 +1,45 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include "silence.h"
+
+int pcm_is_silent(const uint8_t *data, size_t len) {
+  uint64_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0, w[4];
+  size_t i = 0;
+
+  /* 每 256 字节检查一次，既能提前退出又不打断向量化 */
+  while (len - i >= 32) {
+    size_t end = i + ((len - i < 256 ? len - i : 256) & ~(size_t) 31);
+    for (; i < end; i += 32) {
+      memcpy(w, data + i, sizeof(w));
+      acc0 |= w[0];
+      acc1 |= w[1];
+      acc2 |= w[2];
+      acc3 |= w[3];
+    }
+    if (acc0 | acc1 | acc2 | acc3) return 0;
+  }
+
+  for (; i < len; i++) {
+    if (data[i]) return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,31 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_SILENCE_H
+#define DSP_SILENCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * 整数 PCM 的数字静音即所有字节为 0，与位宽和声道数无关
+ */
+int pcm_is_silent(const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,227 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_SIMD_H
+#define DSP_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DSP_NEON 1
+#endif
+
+/**
+ * 点积，n 必须是 8 的倍数
+ */
+static inline float simd_dot(const float *a, const float *b, size_t n) {
+  size_t i;
+#if defined(__AVX__)
+  __m256 acc = _mm256_setzero_ps();
+  __m128 sum;
+  for (i = 0; i < n; i += 8) {
+#if defined(__FMA__)
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+#else
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#endif
+  }
+  sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+#elif defined(__SSE__)
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  for (i = 0; i < n; i += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  acc0 = _mm_add_ps(acc0, acc1);
+  acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+  acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+  return _mm_cvtss_f32(acc0);
+#elif defined(DSP_NEON)
+  float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+  float32x2_t sum;
+  for (i = 0; i < n; i += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+  float acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+  for (i = 0; i < n; i += 4) {
+    acc0 += a[i] * b[i];
+    acc1 += a[i + 1] * b[i + 1];
+    acc2 += a[i + 2] * b[i + 2];
+    acc3 += a[i + 3] * b[i + 3];
+  }
+  return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
+
+/**
+ * 分离格式的复数乘加：acc += x * h
+ */
+static inline void simd_cmac(float *acc_re, float *acc_im, const float *xr, const float *xi, const float *hr,
+                             const float *hi, size_t n) {
+  size_t i = 0;
+#if defined(__AVX__)
+  __m256 ar, ai, vxr, vxi, vhr, vhi;
+  for (; i + 8 <= n; i += 8) {
+    vxr = _mm256_loadu_ps(xr + i);
+    vxi = _mm256_loadu_ps(xi + i);
+    vhr = _mm256_loadu_ps(hr + i);
+    vhi = _mm256_loadu_ps(hi + i);
+    ar = _mm256_loadu_ps(acc_re + i);
+    ai = _mm256_loadu_ps(acc_im + i);
+#if defined(__FMA__)
+    ar = _mm256_fmadd_ps(vxr, vhr, ar);
+    ar = _mm256_fnmadd_ps(vxi, vhi, ar);
+    ai = _mm256_fmadd_ps(vxr, vhi, ai);
+    ai = _mm256_fmadd_ps(vxi, vhr, ai);
+#else
+    ar = _mm256_add_ps(ar, _mm256_sub_ps(_mm256_mul_ps(vxr, vhr), _mm256_mul_ps(vxi, vhi)));
+    ai = _mm256_add_ps(ai, _mm256_add_ps(_mm256_mul_ps(vxr, vhi), _mm256_mul_ps(vxi, vhr)));
+#endif
+    _mm256_storeu_ps(acc_re + i, ar);
+    _mm256_storeu_ps(acc_im + i, ai);
+  }
+#elif defined(__SSE__)
+  __m128 ar, ai, vxr, vxi, vhr, vhi;
+  for (; i + 4 <= n; i += 4) {
+    vxr = _mm_loadu_ps(xr + i);
+    vxi = _mm_loadu_ps(xi + i);
+    vhr = _mm_loadu_ps(hr + i);
+    vhi = _mm_loadu_ps(hi + i);
+    ar = _mm_add_ps(_mm_loadu_ps(acc_re + i), _mm_sub_ps(_mm_mul_ps(vxr, vhr), _mm_mul_ps(vxi, vhi)));
+    ai = _mm_add_ps(_mm_loadu_ps(acc_im + i), _mm_add_ps(_mm_mul_ps(vxr, vhi), _mm_mul_ps(vxi, vhr)));
+    _mm_storeu_ps(acc_re + i, ar);
+    _mm_storeu_ps(acc_im + i, ai);
+  }
+#elif defined(DSP_NEON)
+  float32x4_t ar, ai, vxr, vxi, vhr, vhi;
+  for (; i + 4 <= n; i += 4) {
+    vxr = vld1q_f32(xr + i);
+    vxi = vld1q_f32(xi + i);
+    vhr = vld1q_f32(hr + i);
+    vhi = vld1q_f32(hi + i);
+    ar = vmlsq_f32(vmlaq_f32(vld1q_f32(acc_re + i), vxr, vhr), vxi, vhi);
+    ai = vmlaq_f32(vmlaq_f32(vld1q_f32(acc_im + i), vxr, vhi), vxi, vhr);
+    vst1q_f32(acc_re + i, ar);
+    vst1q_f32(acc_im + i, ai);
+  }
+#endif
+  for (; i < n; i++) {
+    acc_re[i] += xr[i] * hr[i] - xi[i] * hi[i];
+    acc_im[i] += xr[i] * hi[i] + xi[i] * hr[i];
+  }
+}
+
+/**
+ * 峰值绝对值、平方和与 |x| >= clip 的个数，n 任意，结果与已有的 peak/sum/clips 合并
+ */
+static inline void simd_peak_power(const float *x, size_t n, float clip, float *peak, float *sum, uint32_t *clips) {
+  size_t i = 0;
+  float pk = *peak, sq = 0, a;
+  uint32_t cl = 0;
+#if defined(__AVX__)
+  const __m256 sign = _mm256_set1_ps(-0.0f), vclip = _mm256_set1_ps(clip);
+  __m256 vpk = _mm256_setzero_ps(), vsq = _mm256_setzero_ps(), v, va;
+  __m128 t;
+  for (; i + 8 <= n; i += 8) {
+    v = _mm256_loadu_ps(x + i);
+    va = _mm256_andnot_ps(sign, v);
+    vpk = _mm256_max_ps(vpk, va);
+#if defined(__FMA__)
+    vsq = _mm256_fmadd_ps(v, v, vsq);
+#else
+    vsq = _mm256_add_ps(vsq, _mm256_mul_ps(v, v));
+#endif
+    cl += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(va, vclip, _CMP_GE_OQ)));
+  }
+  t = _mm_max_ps(_mm256_castps256_ps128(vpk), _mm256_extractf128_ps(vpk, 1));
+  t = _mm_max_ps(t, _mm_movehl_ps(t, t));
+  t = _mm_max_ss(t, _mm_shuffle_ps(t, t, 1));
+  a = _mm_cvtss_f32(t);
+  pk = a > pk ? a : pk;
+  t = _mm_add_ps(_mm256_castps256_ps128(vsq), _mm256_extractf128_ps(vsq, 1));
+  t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+  t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+  sq = _mm_cvtss_f32(t);
+#elif defined(__SSE__)
+  const __m128 sign = _mm_set1_ps(-0.0f), vclip = _mm_set1_ps(clip);
+  __m128 vpk = _mm_setzero_ps(), vsq = _mm_setzero_ps(), v, va;
+  for (; i + 4 <= n; i += 4) {
+    v = _mm_loadu_ps(x + i);
+    va = _mm_andnot_ps(sign, v);
+    vpk = _mm_max_ps(vpk, va);
+    vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+    cl += __builtin_popcount(_mm_movemask_ps(_mm_cmpge_ps(va, vclip)));
+  }
+  vpk = _mm_max_ps(vpk, _mm_movehl_ps(vpk, vpk));
+  vpk = _mm_max_ss(vpk, _mm_shuffle_ps(vpk, vpk, 1));
+  a = _mm_cvtss_f32(vpk);
+  pk = a > pk ? a : pk;
+  vsq = _mm_add_ps(vsq, _mm_movehl_ps(vsq, vsq));
+  vsq = _mm_add_ss(vsq, _mm_shuffle_ps(vsq, vsq, 1));
+  sq = _mm_cvtss_f32(vsq);
+#elif defined(DSP_NEON)
+  const float32x4_t vclip = vdupq_n_f32(clip);
+  float32x4_t vpk = vdupq_n_f32(0), vsq = vdupq_n_f32(0), v, va;
+  uint32x4_t vcl = vdupq_n_u32(0);
+  float32x2_t t;
+  uint32x2_t c;
+  for (; i + 4 <= n; i += 4) {
+    v = vld1q_f32(x + i);
+    va = vabsq_f32(v);
+    vpk = vmaxq_f32(vpk, va);
+    vsq = vmlaq_f32(vsq, v, v);
+    // 比较结果为全 1，减去即计数加一
+    vcl = vsubq_u32(vcl, vcgeq_f32(va, vclip));
+  }
+  t = vpmax_f32(vget_low_f32(vpk), vget_high_f32(vpk));
+  a = vget_lane_f32(vpmax_f32(t, t), 0);
+  pk = a > pk ? a : pk;
+  t = vadd_f32(vget_low_f32(vsq), vget_high_f32(vsq));
+  sq = vget_lane_f32(vpadd_f32(t, t), 0);
+  c = vadd_u32(vget_low_u32(vcl), vget_high_u32(vcl));
+  cl = vget_lane_u32(vpadd_u32(c, c), 0);
+#endif
+  for (; i < n; i++) {
+    a = fabsf(x[i]);
+    pk = a > pk ? a : pk;
+    sq += x[i] * x[i];
+    cl += a >= clip;
+  }
+
+  *peak = pk;
+  *sum += sq;
+  *clips += cl;
+}
+
+#endif
@@ -0,0 +1,163 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "common/common.h"
+#include "workers.h"
+
+static pthread_t threads[WORKERS_MAX];
+static uint32_t threads_len = 0;
+static int running = 0;
+
+/* 每个处理周期 generation 加一，全部工作线程完成后 pending 归零 */
+static pthread_mutex_t wk_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wk_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wk_done = PTHREAD_COND_INITIALIZER;
+static uint64_t generation = 0;
+static uint64_t base_generation = 0;
+static uint32_t pending = 0;
+static worker_fn job_fn = NULL;
+static void *job_arg = NULL;
+static uint32_t job_channels = 0;
+
+LOG_TAG_DECLR("dsp");
+
+static uint32_t cpu_count() {
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (uint32_t) n : 1;
+#else
+  return 1;
+#endif
+}
+
+static void worker_pin(uint32_t index) {
+#ifdef __linux__
+  cpu_set_t set;
+  uint32_t cpu = (index + 1) % cpu_count();
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) LOGD("worker %u pin cpu %u failed", index, cpu);
+#endif
+}
+
+static void *thread_worker(void *arg) {
+  uint32_t index = (uint32_t) (uintptr_t) arg, stride = threads_len + 1, ch;
+  uint64_t seen = base_generation;
+  worker_fn fn;
+  void *fn_arg;
+  uint32_t channels;
+
+  worker_pin(index);
+
+  pthread_mutex_lock(&wk_mutex);
+  while (running) {
+    if (generation == seen) {
+      pthread_cond_wait(&wk_start, &wk_mutex);
+      continue;
+    }
+    seen = generation;
+    fn = job_fn;
+    fn_arg = job_arg;
+    channels = job_channels;
+    pthread_mutex_unlock(&wk_mutex);
+
+    for (ch = index + 1; ch < channels; ch += stride) fn(fn_arg, ch);
+
+    pthread_mutex_lock(&wk_mutex);
+    if (--pending == 0) pthread_cond_signal(&wk_done);
+  }
+  pthread_mutex_unlock(&wk_mutex);
+
+  pthread_exit(NULL);
+}
+
+int workers_init(uint32_t n, uint32_t channels) {
+  uint32_t i;
+
+  // 单声道由调用线程处理即可，也避免下面的减一下溢
+  if (channels < 2 || n == WORKERS_INLINE) return 0;
+  if (n == 0) n = min(cpu_count(), channels) - 1;
+  if (n > WORKERS_MAX) n = WORKERS_MAX;
+  if (n >= channels) n = channels - 1;
+  if (n == 0) return 0;
+
+  running = 1;
+  threads_len = n;
+  base_generation = generation;
+  for (i = 0; i < n; i++) {
+    if (0 != pthread_create(&threads[i], NULL, thread_worker, (void *) (uintptr_t) i)) {
+      LOGE("worker thread create error: %m");
+      threads_len = i;
+      workers_deinit();
+      return -1;
+    }
+  }
+
+  LOGI("dsp workers %u for %u channels", n, channels);
+  return 0;
+}
+
+void workers_deinit() {
+  uint32_t i;
+
+  if (!running) return;
+
+  pthread_mutex_lock(&wk_mutex);
+  running = 0;
+  pthread_cond_broadcast(&wk_start);
+  pthread_mutex_unlock(&wk_mutex);
+
+  for (i = 0; i < threads_len; i++) pthread_join(threads[i], NULL);
+  threads_len = 0;
+}
+
+void workers_run(worker_fn fn, void *arg, uint32_t channels) {
+  uint32_t ch, stride = threads_len + 1;
+
+  if (threads_len == 0 || channels < 2) {
+    for (ch = 0; ch < channels; ch++) fn(arg, ch);
+    return;
+  }
+
+  pthread_mutex_lock(&wk_mutex);
+  job_fn = fn;
+  job_arg = arg;
+  job_channels = channels;
+  pending = threads_len;
+  generation++;
+  pthread_cond_broadcast(&wk_start);
+  pthread_mutex_unlock(&wk_mutex);
+
+  for (ch = 0; ch < channels; ch += stride) fn(arg, ch);
+
+  pthread_mutex_lock(&wk_mutex);
+  while (pending) pthread_cond_wait(&wk_done, &wk_mutex);
+  pthread_mutex_unlock(&wk_mutex);
+}
+
+uint32_t workers_count() {
+  return threads_len;
+}
@@ -0,0 +1,47 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DSP_WORKERS_H
+#define DSP_WORKERS_H
+
+#include <stdint.h>
+
+#define WORKERS_MAX 16
+/* 不创建工作线程，所有声道在调用线程中处理 */
+#define WORKERS_INLINE UINT32_MAX
+
+typedef void (*worker_fn)(void *arg, uint32_t ch);
+
+/**
+ * 创建 threads 个工作线程，0 表示按 CPU 核数和声道数自动选择，单核或者少于两个声道时不创建线程。
+ * 调用线程也参与处理，声道 ch 固定由第 ch % (threads + 1) 个执行者处理，
+ * 工作线程 i 绑定到 CPU i + 1
+ */
+int workers_init(uint32_t threads, uint32_t channels);
+
+void workers_deinit();
+
+/**
+ * 对每个声道调用 fn，所有声道处理完成后返回
+ */
+void workers_run(worker_fn fn, void *arg, uint32_t channels);
+
+uint32_t workers_count();
+
+#endif
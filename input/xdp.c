@@ -0,0 +1,351 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <xdp/xsk.h>
+#include <xdp/libxdp.h>
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+#include "xdp.h"
+#include "../speaker_receiver.h"
+
+#define XDP_UMEM_SIZE (XDP_NUM_FRAMES * XSK_UMEM__DEFAULT_FRAME_SIZE)
+#define XDP_VLAN_HLEN 4
+/* fill ring 满时先重试这么多次，之后每次等待 XDP_FILL_WAIT_USEC，不空转占满 CPU */
+#define XDP_FILL_SPIN 64
+#define XDP_FILL_WAIT_USEC 100
+
+static struct xdp_config xdp_cfg = {0};
+static int xdp_ifindex = 0;
+static enum xdp_attach_mode xdp_mode = XDP_MODE_UNSPEC;
+static struct xdp_program *xdp_prog = NULL;
+static void *umem_area = NULL;
+static struct xsk_umem *umem = NULL;
+static struct xsk_ring_prod fill_ring;
+static struct xsk_ring_cons comp_ring;
+static struct xsk_socket *xsk = NULL;
+static struct xsk_ring_cons rx_ring;
+static int zero_copy = 0;
+
+static pthread_t xdp_thread;
+static atomic_int xdp_running = 0;
+static atomic_uint_fast64_t xdp_packets = 0;
+
+LOG_TAG_DECLR("xdp");
+
+/**
+ * 解析以太网、IP 和 UDP 头，data 指向 UDP 负载。
+ * 内核程序已经按目的端口过滤，这里只做长度检查
+ */
+static const uint8_t *xdp_parse(const uint8_t *pkt, uint32_t len, struct sockaddr_storage *src, socklen_t *src_len,
+                                uint32_t *payload_len) {
+  const struct ethhdr *eth = (const struct ethhdr *) pkt;
+  const struct iphdr *ip4;
+  const struct ip6_hdr *ip6;
+  const struct udphdr *udp;
+  uint32_t off = sizeof(struct ethhdr), ulen;
+  uint16_t proto;
+
+  if (len < off) return NULL;
+  proto = ntohs(eth->h_proto);
+  if (proto == ETH_P_8021Q || proto == ETH_P_8021AD) {
+    if (len < off + XDP_VLAN_HLEN) return NULL;
+    proto = ntohs(*(const uint16_t *) (pkt + off + 2));
+    off += XDP_VLAN_HLEN;
+  }
+
+  if (proto == ETH_P_IP) {
+    ip4 = (const struct iphdr *) (pkt + off);
+    // 与内核协议栈一样拒绝 ihl 小于 5 的包，否则 UDP 头会落在 IP 头里
+    if (len < off + sizeof(struct iphdr) || ip4->ihl < 5 || ip4->protocol != IPPROTO_UDP) return NULL;
+    struct sockaddr_in *sin = (struct sockaddr_in *) src;
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = ip4->saddr;
+    *src_len = sizeof(struct sockaddr_in);
+    off += ip4->ihl * 4;
+  } else if (proto == ETH_P_IPV6) {
+    ip6 = (const struct ip6_hdr *) (pkt + off);
+    if (len < off + sizeof(struct ip6_hdr) || ip6->ip6_nxt != IPPROTO_UDP) return NULL;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) src;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_addr = ip6->ip6_src;
+    *src_len = sizeof(struct sockaddr_in6);
+    off += sizeof(struct ip6_hdr);
+  } else {
+    return NULL;
+  }
+
+  if (len < off + sizeof(struct udphdr)) return NULL;
+  udp = (const struct udphdr *) (pkt + off);
+  ulen = ntohs(udp->len);
+  off += sizeof(struct udphdr);
+  if (ulen < sizeof(struct udphdr) || off + ulen - sizeof(struct udphdr) > len) return NULL;
+
+  // 回包走普通 socket，端口在两种地址族中的位置相同
+  ((struct sockaddr_in *) src)->sin_port = udp->source;
+  *payload_len = ulen - sizeof(struct udphdr);
+  return pkt + off;
+}
+
+static void xdp_receive(uint32_t rcvd, uint32_t idx_rx) {
+  struct sockaddr_storage src;
+  const struct xdp_desc *desc;
+  const uint8_t *payload;
+  socklen_t src_len;
+  uint32_t i, idx_fq = 0, len, tries;
+  uint64_t addr;
+
+  // 每个收到的帧都要还给 fill ring，填满之前不能释放 rx ring
+  for (tries = 0; xsk_ring_prod__reserve(&fill_ring, rcvd, &idx_fq) != rcvd; tries++) {
+    if (!atomic_load_explicit(&xdp_running, memory_order_relaxed)) return;
+    if (xsk_ring_prod__needs_wakeup(&fill_ring)) recvfrom(xsk_socket__fd(xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    if (tries >= XDP_FILL_SPIN) usleep(XDP_FILL_WAIT_USEC);
+  }
+
+  for (i = 0; i < rcvd; i++) {
+    desc = xsk_ring_cons__rx_desc(&rx_ring, idx_rx + i);
+    addr = xsk_umem__add_offset_to_addr(desc->addr);
+
+    memset(&src, 0, sizeof(src));
+    payload = xdp_parse(xsk_umem__get_data(umem_area, addr), desc->len, &src, &src_len, &len);
+    if (payload) receiver_package(&src, src_len, payload, len);
+
+    *xsk_ring_prod__fill_addr(&fill_ring, idx_fq + i) = xsk_umem__extract_addr(desc->addr);
+  }
+
+  xsk_ring_prod__submit(&fill_ring, rcvd);
+  xsk_ring_cons__release(&rx_ring, rcvd);
+  atomic_fetch_add_explicit(&xdp_packets, rcvd, memory_order_relaxed);
+}
+
+static void *thread_xdp(void *arg) {
+  struct pollfd pfd = {.fd = xsk_socket__fd(xsk), .events = POLLIN};
+  uint32_t rcvd, idx_rx = 0;
+
+  while (atomic_load_explicit(&xdp_running, memory_order_relaxed)) {
+    rcvd = xsk_ring_cons__peek(&rx_ring, XDP_RX_BATCH, &idx_rx);
+    if (rcvd) {
+      xdp_receive(rcvd, idx_rx);
+      continue;
+    }
+
+    if (xsk_ring_prod__needs_wakeup(&fill_ring)) recvfrom(pfd.fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    poll(&pfd, 1, 100);
+  }
+
+  pthread_exit(NULL);
+}
+
+static int xdp_attach() {
+  long err;
+
+  xdp_prog = xdp_program__open_file(xdp_cfg.prog_path, "xdp", NULL);
+  err = libxdp_get_error(xdp_prog);
+  if (err) {
+    LOGE("open xdp program %s error: %s", xdp_cfg.prog_path, strerror(-err));
+    xdp_prog = NULL;
+    return -1;
+  }
+
+  // 网卡驱动不支持时退回到 generic 模式，veth 两种都支持
+  xdp_mode = XDP_MODE_NATIVE;
+  if (xdp_program__attach(xdp_prog, xdp_ifindex, xdp_mode, 0) != 0) {
+    xdp_mode = XDP_MODE_SKB;
+    if ((err = xdp_program__attach(xdp_prog, xdp_ifindex, xdp_mode, 0)) != 0) {
+      LOGE("attach xdp program to %s error: %s", xdp_cfg.ifname, strerror(-err));
+      xdp_program__close(xdp_prog);
+      xdp_prog = NULL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int xdp_map_update(const char *name, const void *key, const void *value) {
+  struct bpf_map *map = bpf_object__find_map_by_name(xdp_program__bpf_obj(xdp_prog), name);
+
+  if (map == NULL) {
+    LOGE("xdp map %s not found", name);
+    return -1;
+  }
+  if (key == NULL) return bpf_map__fd(map);
+
+  if (bpf_map_update_elem(bpf_map__fd(map), key, value, 0) != 0) {
+    LOGE("update xdp map %s error: %m", name);
+    return -1;
+  }
+  return 0;
+}
+
+static int xdp_socket() {
+  struct xsk_umem_config umem_cfg = {
+    .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+    .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+    .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+    .frame_headroom = 0,
+    .flags = 0,
+  };
+  struct xsk_socket_config xsk_cfg = {
+    .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+    .tx_size = 0,
+    .libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD,
+    .xdp_flags = 0,
+    .bind_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY,
+  };
+  uint32_t i, idx = 0;
+  int ret, map_fd;
+
+  umem_area = mmap(NULL, XDP_UMEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (umem_area == MAP_FAILED) {
+    umem_area = NULL;
+    LOGE("xdp umem alloc error: %m");
+    return -1;
+  }
+
+  ret = xsk_umem__create(&umem, umem_area, XDP_UMEM_SIZE, &fill_ring, &comp_ring, &umem_cfg);
+  if (ret) {
+    LOGE("xdp umem create error: %s", strerror(-ret));
+    return -1;
+  }
+
+  ret = xsk_socket__create(&xsk, xdp_cfg.ifname, xdp_cfg.queue, umem, &rx_ring, NULL, &xsk_cfg);
+  if (ret) {
+    xsk_cfg.bind_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+    ret = xsk_socket__create(&xsk, xdp_cfg.ifname, xdp_cfg.queue, umem, &rx_ring, NULL, &xsk_cfg);
+  } else {
+    zero_copy = 1;
+  }
+  if (ret) {
+    LOGE("xdp socket on %s queue %u error: %s", xdp_cfg.ifname, xdp_cfg.queue, strerror(-ret));
+    return -1;
+  }
+
+  map_fd = xdp_map_update("xsks_map", NULL, NULL);
+  if (map_fd < 0 || xsk_socket__update_xskmap(xsk, map_fd) != 0) {
+    LOGE("xdp register socket error");
+    return -1;
+  }
+
+  if (xsk_ring_prod__reserve(&fill_ring, XSK_RING_PROD__DEFAULT_NUM_DESCS, &idx) !=
+      XSK_RING_PROD__DEFAULT_NUM_DESCS) {
+    LOGE("xdp fill ring reserve error");
+    return -1;
+  }
+  for (i = 0; i < XSK_RING_PROD__DEFAULT_NUM_DESCS; i++) {
+    *xsk_ring_prod__fill_addr(&fill_ring, idx++) = (uint64_t) i * XSK_UMEM__DEFAULT_FRAME_SIZE;
+  }
+  xsk_ring_prod__submit(&fill_ring, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+
+  return 0;
+}
+
+int xdp_input_init(const struct xdp_config *cfg) {
+  uint32_t key = 0;
+  uint16_t port;
+
+  LOGT("xdp init");
+
+  if (cfg == NULL || cfg->ifname == NULL || cfg->prog_path == NULL) return -1;
+  if (cfg->queue >= XDP_MAX_QUEUES) {
+    LOGE("xdp queue %u exceeds %d", cfg->queue, XDP_MAX_QUEUES);
+    return -1;
+  }
+  xdp_cfg = *cfg;
+
+  xdp_ifindex = if_nametoindex(xdp_cfg.ifname);
+  if (xdp_ifindex == 0) {
+    LOGE("xdp iface %s error: %m", xdp_cfg.ifname);
+    return -1;
+  }
+
+  if (xdp_attach() != 0) return -1;
+
+  port = htons(xdp_cfg.port);
+  if (xdp_map_update("port_map", &key, &port) != 0 || xdp_socket() != 0) {
+    xdp_input_deinit();
+    return -1;
+  }
+
+  receiver_set_shared(1);
+  atomic_store(&xdp_running, 1);
+  if (0 != pthread_create(&xdp_thread, NULL, thread_xdp, NULL)) {
+    LOGE("xdp thread create error: %m");
+    atomic_store(&xdp_running, 0);
+    xdp_input_deinit();
+    return -1;
+  }
+
+  LOGI("xdp on %s queue %u port %u, %s mode%s", xdp_cfg.ifname, xdp_cfg.queue, xdp_cfg.port,
+       xdp_mode == XDP_MODE_NATIVE ? "native" : "generic", zero_copy ? ", zero copy" : "");
+  return 0;
+}
+
+void xdp_input_deinit() {
+  LOGT("xdp deinit");
+
+  if (atomic_exchange(&xdp_running, 0)) {
+    pthread_join(xdp_thread, NULL);
+  }
+
+  // 先卸载程序，之后的包重新走普通 socket
+  if (xdp_prog) {
+    xdp_program__detach(xdp_prog, xdp_ifindex, xdp_mode, 0);
+    xdp_program__close(xdp_prog);
+    xdp_prog = NULL;
+  }
+  if (xsk) {
+    xsk_socket__delete(xsk);
+    xsk = NULL;
+  }
+  if (umem) {
+    xsk_umem__delete(umem);
+    umem = NULL;
+  }
+  if (umem_area) {
+    munmap(umem_area, XDP_UMEM_SIZE);
+    umem_area = NULL;
+  }
+  zero_copy = 0;
+  receiver_set_shared(0);
+}
+
+int xdp_input_stats(struct xdp_stats *stats) {
+  struct xdp_statistics xs = {0};
+  socklen_t len = sizeof(xs);
+
+  if (xsk == NULL) return -1;
+
+  if (getsockopt(xsk_socket__fd(xsk), SOL_XDP, XDP_STATISTICS, &xs, &len) < 0) return -1;
+
+  stats->packets = atomic_load_explicit(&xdp_packets, memory_order_relaxed);
+  stats->dropped = xs.rx_dropped + xs.rx_ring_full;
+  stats->fill_empty = xs.rx_fill_ring_empty_descs;
+  stats->zero_copy = zero_copy;
+  return 0;
+}
@@ -0,0 +1,54 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef XDP_H
+#define XDP_H
+
+#include "../speaker.h"
+
+#define XDP_NUM_FRAMES 4096
+#define XDP_RX_BATCH 64
+#define XDP_MAX_QUEUES 64
+
+struct xdp_config {
+    const char *ifname;
+    uint32_t queue;
+    uint16_t port;
+    const char *prog_path;
+};
+
+struct xdp_stats {
+    uint64_t packets;
+    uint64_t dropped;
+    uint64_t fill_empty;
+    int zero_copy;
+};
+
+/**
+ * 在 ifname 的 queue 上加载 XDP 程序并创建 AF_XDP socket，数据端口的包在 UMEM 中
+ * 原地解析后交给 receiver_package。
+ * @return -1 表示不可用，调用者继续使用普通 socket
+ */
+int xdp_input_init(const struct xdp_config *cfg);
+
+void xdp_input_deinit();
+
+int xdp_input_stats(struct xdp_stats *stats);
+
+#endif
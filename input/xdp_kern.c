@@ -0,0 +1,103 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#define XDP_MAX_QUEUES 64
+
+struct vlan_hdr {
+    __be16 tci;
+    __be16 proto;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, XDP_MAX_QUEUES);
+    __type(key, __u32);
+    __type(value, __u32);
+} xsks_map SEC(".maps");
+
+/* 网络字节序的数据端口，由用户态写入 */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u16);
+} port_map SEC(".maps");
+
+/**
+ * 只把发往 castspeaker 数据端口的 UDP 包转给 AF_XDP socket，其它包交给内核协议栈。
+ * 当前队列没有绑定 socket 时 bpf_redirect_map 返回 XDP_PASS，由普通 socket 接收
+ */
+SEC("xdp")
+int castspeaker_xdp(struct xdp_md *ctx) {
+  void *data = (void *) (long) ctx->data;
+  void *end = (void *) (long) ctx->data_end;
+  struct ethhdr *eth = data;
+  struct vlan_hdr *vlan;
+  struct iphdr *ip4;
+  struct ipv6hdr *ip6;
+  struct udphdr *udp;
+  __u32 key = 0;
+  __u16 *port, proto;
+  void *l4;
+
+  if ((void *) (eth + 1) > end) return XDP_PASS;
+  proto = eth->h_proto;
+  l4 = eth + 1;
+
+  if (proto == bpf_htons(ETH_P_8021Q) || proto == bpf_htons(ETH_P_8021AD)) {
+    vlan = l4;
+    if ((void *) (vlan + 1) > end) return XDP_PASS;
+    proto = vlan->proto;
+    l4 = vlan + 1;
+  }
+
+  if (proto == bpf_htons(ETH_P_IP)) {
+    ip4 = l4;
+    // ihl 小于 5 的畸形包交给内核丢弃
+    if ((void *) (ip4 + 1) > end || ip4->ihl < 5 || ip4->protocol != IPPROTO_UDP) return XDP_PASS;
+    // 分片由内核重组
+    if (ip4->frag_off & bpf_htons(0x3FFF)) return XDP_PASS;
+    l4 = (void *) ip4 + ip4->ihl * 4;
+  } else if (proto == bpf_htons(ETH_P_IPV6)) {
+    ip6 = l4;
+    if ((void *) (ip6 + 1) > end || ip6->nexthdr != IPPROTO_UDP) return XDP_PASS;
+    l4 = ip6 + 1;
+  } else {
+    return XDP_PASS;
+  }
+
+  udp = l4;
+  if ((void *) (udp + 1) > end) return XDP_PASS;
+
+  port = bpf_map_lookup_elem(&port_map, &key);
+  if (port == NULL || udp->dest != *port) return XDP_PASS;
+
+  return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
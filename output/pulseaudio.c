@@ -0,0 +1,374 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pulse/simple.h>
+#include <pulse/error.h>
+#include <pulse/sample.h>
+#include "pulseaudio.h"
+#include "../speaker_recorder.h"
+
+#define PA_RING_SIZE (1 << 18)
+#define PA_WRITE_CHUNK 4096
+#define PA_LOW_LATENCY_USEC 20000
+#define PA_LOW_LATENCY_MINREQ_USEC 5000
+#define PA_DEFAULT_LATENCY_USEC 200000
+/* 延迟低于这个值时声卡基本已经没有数据，记为一次欠载 */
+#define PA_UNDERRUN_USEC 2000
+/* 写入失败后关闭流重新打开，打开失败时按这个间隔重试 */
+#define PA_RETRY_SEC 1
+
+static struct pulse_config pa_cfg = {0};
+static pa_simple *pa = NULL;
+static pa_sample_spec pa_spec = {0};
+static pa_sample_spec pa_pending = {0};
+
+static pthread_t pa_thread;
+static pthread_mutex_t pa_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pa_cond = PTHREAD_COND_INITIALIZER;
+static int pa_running = 0;
+
+/* 网络线程只写入环形缓冲区，由写线程调用阻塞的 pa_simple_write */
+static uint8_t pa_ring[PA_RING_SIZE];
+static size_t pa_ring_r = 0, pa_ring_w = 0;
+static size_t pa_reformat_at = 0;
+static int pa_reformat = 0;
+static int pa_flush = 0;
+static int pa_suspend = 0;
+static int pa_parked = 0;
+static uint32_t pa_overruns = 0;
+static uint32_t pa_overrun_burst = 0;
+static uint32_t pa_write_errors = 0;
+static time_t pa_retry_at = 0;
+static pa_usec_t pa_last_latency = 0;
+
+static atomic_uint_fast32_t pa_latency = 0;
+static atomic_int pa_draining = 0;
+
+LOG_TAG_DECLR("output");
+
+static pa_sample_format_t pa_format(audio_bits_t bits) {
+  switch (bits_name(bits)) {
+    case 16:
+      return PA_SAMPLE_S16LE;
+    case 24:
+      return PA_SAMPLE_S24LE;
+    case 32:
+      return PA_SAMPLE_S32LE;
+    default:
+      return PA_SAMPLE_INVALID;
+  }
+}
+
+static void *thread_pulse_drain(void *arg) {
+  pa_simple_drain(arg, NULL);
+  pa_simple_free(arg);
+  atomic_fetch_sub(&pa_draining, 1);
+
+  pthread_exit(NULL);
+}
+
+/**
+ * 旧格式的流在后台线程中播放完剩余的数据再关闭，写线程直接开始写新的流
+ */
+static void pa_retire(pa_simple *old) {
+  pthread_attr_t attr;
+  pthread_t t;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  atomic_fetch_add(&pa_draining, 1);
+  if (0 != pthread_create(&t, &attr, thread_pulse_drain, old)) {
+    LOGW("pulseaudio drain thread create error: %m");
+    atomic_fetch_sub(&pa_draining, 1);
+    pa_simple_free(old);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+static int pa_open(const pa_sample_spec *spec) {
+  int error = 0;
+  pa_buffer_attr attr;
+
+  if (pa) {
+    pa_retire(pa);
+    pa = NULL;
+  }
+  pa_spec = *spec;
+  pa_last_latency = 0;
+
+  attr.maxlength = (uint32_t) -1;
+  attr.prebuf = (uint32_t) -1;
+  attr.fragsize = (uint32_t) -1;
+  if (pa_cfg.low_latency) {
+    attr.tlength = pa_usec_to_bytes(PA_LOW_LATENCY_USEC, spec);
+    attr.minreq = pa_usec_to_bytes(PA_LOW_LATENCY_MINREQ_USEC, spec);
+  } else {
+    attr.tlength = pa_usec_to_bytes(PA_DEFAULT_LATENCY_USEC, spec);
+    attr.minreq = (uint32_t) -1;
+  }
+
+  pa = pa_simple_new(NULL, "castspeaker", PA_STREAM_PLAYBACK, pa_cfg.sink, pa_cfg.stream_name, spec, NULL, &attr,
+                     &error);
+  if (pa == NULL) {
+    LOGE("pulseaudio open stream failed: %s", pa_strerror(error));
+    return -1;
+  }
+
+  LOGI("pulseaudio stream %uHz/%s tlength %u bytes", spec->rate, pa_sample_format_to_string(spec->format),
+       attr.tlength);
+  return 0;
+}
+
+static void pa_request_format(const pa_sample_spec *spec) {
+  pthread_mutex_lock(&pa_mutex);
+  if (memcmp(&pa_pending, spec, sizeof(pa_sample_spec)) != 0) {
+    pa_pending = *spec;
+    pa_reformat_at = pa_ring_w;
+    pa_reformat = 1;
+    pthread_cond_signal(&pa_cond);
+  }
+  pthread_mutex_unlock(&pa_mutex);
+}
+
+static void *thread_pulse_writer(void *arg) {
+  int error = 0;
+  size_t n, limit, off;
+  pa_sample_spec spec;
+  pa_usec_t latency;
+
+  pthread_mutex_lock(&pa_mutex);
+  while (pa_running) {
+    if (pa_flush) {
+      pa_flush = 0;
+      pa_last_latency = 0;
+      pthread_mutex_unlock(&pa_mutex);
+      if (pa) pa_simple_flush(pa, NULL);
+      pthread_mutex_lock(&pa_mutex);
+      continue;
+    }
+
+    // 待机时关闭流，让声卡和 PipeWire 节点可以进入挂起状态
+    if (pa_suspend && pa && pa_ring_r == pa_ring_w) {
+      pthread_mutex_unlock(&pa_mutex);
+      pa_simple_drain(pa, NULL);
+      pa_simple_free(pa);
+      pa = NULL;
+      pa_parked = 1;
+      pa_last_latency = 0;
+      atomic_store(&pa_latency, 0);
+      pthread_mutex_lock(&pa_mutex);
+      continue;
+    }
+
+    if (pa_ring_r == pa_ring_w && !pa_reformat) {
+      pthread_cond_wait(&pa_cond, &pa_mutex);
+      continue;
+    }
+
+    if (pa_reformat && pa_ring_r == pa_reformat_at) {
+      spec = pa_pending;
+      pa_reformat = 0;
+      pthread_mutex_unlock(&pa_mutex);
+      pa_parked = pa_open(&spec) != 0;
+      pa_retry_at = time(NULL) + PA_RETRY_SEC;
+      pthread_mutex_lock(&pa_mutex);
+      continue;
+    }
+
+    // 打开失败时丢弃数据，不阻塞网络线程，每 PA_RETRY_SEC 秒重试一次
+    if (pa_parked && time(NULL) >= pa_retry_at) {
+      spec = pa_spec;
+      pthread_mutex_unlock(&pa_mutex);
+      if (pa_open(&spec) == 0) {
+        pa_parked = 0;
+        if (pa_write_errors) LOGI("pulseaudio stream reopened after %u write errors", pa_write_errors);
+        pa_write_errors = 0;
+      } else {
+        pa_retry_at = time(NULL) + PA_RETRY_SEC;
+      }
+      pthread_mutex_lock(&pa_mutex);
+      continue;
+    }
+
+    limit = pa_reformat ? pa_reformat_at : pa_ring_w;
+    off = pa_ring_r % PA_RING_SIZE;
+    n = min(limit - pa_ring_r, PA_RING_SIZE - off);
+    n = min(n, PA_WRITE_CHUNK);
+    pthread_mutex_unlock(&pa_mutex);
+
+    if (pa && pa_simple_write(pa, pa_ring + off, n, &error) < 0) {
+      // 流已经失效，后续的每个块都会失败，只记录第一次并重新打开
+      if (pa_write_errors++ == 0) LOGE("pulseaudio write failed: %s, reopen stream", pa_strerror(error));
+      pa_simple_free(pa);
+      pa = NULL;
+      pa_parked = 1;
+      pa_retry_at = 0;
+      atomic_store(&pa_latency, 0);
+    }
+
+    pthread_mutex_lock(&pa_mutex);
+    // 写入期间被 flush，读指针已经移动
+    if (!pa_flush) pa_ring_r += n;
+
+    if (pa) {
+      latency = pa_simple_get_latency(pa, NULL) + pa_bytes_to_usec(pa_ring_w - pa_ring_r, &pa_spec);
+      atomic_store(&pa_latency, (uint32_t) latency);
+      if (latency < PA_UNDERRUN_USEC && pa_last_latency >= PA_UNDERRUN_USEC) recorder_event(REC_UNDERRUN, latency);
+      pa_last_latency = latency;
+    }
+  }
+  pthread_mutex_unlock(&pa_mutex);
+
+  pthread_exit(NULL);
+}
+
+int pulse_output_init(const struct pulse_config *cfg) {
+  LOGT("pulseaudio init");
+
+  if (cfg) pa_cfg = *cfg;
+  if (pa_cfg.channels == 0) pa_cfg.channels = 1;
+  if (pa_cfg.channels > PA_CHANNELS_MAX) {
+    LOGE("pulseaudio channels %u exceeds %d", pa_cfg.channels, PA_CHANNELS_MAX);
+    return -1;
+  }
+
+  pa_running = 1;
+  if (0 != pthread_create(&pa_thread, NULL, thread_pulse_writer, NULL)) {
+    LOGE("pulseaudio thread create error: %m");
+    pa_running = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void pulse_output_deinit() {
+  LOGT("pulseaudio deinit");
+
+  if (!pa_running) return;
+
+  pthread_mutex_lock(&pa_mutex);
+  pa_running = 0;
+  pthread_cond_signal(&pa_cond);
+  pthread_mutex_unlock(&pa_mutex);
+  pthread_join(pa_thread, NULL);
+
+  if (pa) {
+    pa_simple_drain(pa, NULL);
+    pa_simple_free(pa);
+    pa = NULL;
+  }
+  while (atomic_load(&pa_draining) > 0) usleep(1000);
+}
+
+int pulse_output_format(audio_rate_t rate, audio_bits_t bits) {
+  pa_sample_spec spec = {
+    .format = pa_format(bits),
+    .rate = rate_name(rate),
+    .channels = pa_cfg.channels,
+  };
+
+  if (spec.format == PA_SAMPLE_INVALID || spec.rate == 0) {
+    LOGE("Unsupported sample format %d/%d", rate_name(rate), bits_name(bits));
+    return -1;
+  }
+
+  pa_request_format(&spec);
+  return 0;
+}
+
+int pulse_output_send(pcm_header_t *header, const uint8_t *data) {
+  header_sample_t *hs = &header->sample;
+  size_t off, n;
+
+  if (!hs->rate) return 1;
+  if (pulse_output_format(hs->rate, hs->bits) != 0) return 1;
+
+  pthread_mutex_lock(&pa_mutex);
+  if (PA_RING_SIZE - (pa_ring_w - pa_ring_r) < header->len) {
+    pthread_mutex_unlock(&pa_mutex);
+    // 连续溢出只记录第一次
+    pa_overruns++;
+    if (!pa_overrun_burst++) LOGW("pulseaudio overrun, drop %d bytes (%u)", header->len, pa_overruns);
+    recorder_event(REC_OVERRUN, header->len);
+    return -1;
+  }
+  pa_overrun_burst = 0;
+
+  off = pa_ring_w % PA_RING_SIZE;
+  n = min(header->len, PA_RING_SIZE - off);
+  memcpy(pa_ring + off, data, n);
+  memcpy(pa_ring, data + n, header->len - n);
+  pa_ring_w += header->len;
+
+  pthread_cond_signal(&pa_cond);
+  pthread_mutex_unlock(&pa_mutex);
+
+  return 0;
+}
+
+uint32_t pulse_output_space() {
+  uint32_t space;
+
+  pthread_mutex_lock(&pa_mutex);
+  space = PA_RING_SIZE - (pa_ring_w - pa_ring_r);
+  pthread_mutex_unlock(&pa_mutex);
+
+  return space;
+}
+
+uint32_t pulse_output_queued() {
+  uint32_t usec = 0;
+
+  pthread_mutex_lock(&pa_mutex);
+  if (pa_sample_spec_valid(&pa_spec))
+    usec = (uint32_t) pa_bytes_to_usec(pa_ring_w - pa_ring_r, &pa_spec);
+  pthread_mutex_unlock(&pa_mutex);
+
+  return usec;
+}
+
+uint32_t pulse_output_latency() {
+  return atomic_load(&pa_latency);
+}
+
+int pulse_output_suspend(int suspend) {
+  pthread_mutex_lock(&pa_mutex);
+  pa_suspend = suspend;
+  pthread_cond_signal(&pa_cond);
+  pthread_mutex_unlock(&pa_mutex);
+
+  return 0;
+}
+
+int pulse_output_flush() {
+  pthread_mutex_lock(&pa_mutex);
+  pa_ring_r = pa_ring_w;
+  if (pa_reformat) pa_reformat_at = pa_ring_w;
+  pa_flush = 1;
+  atomic_store(&pa_latency, 0);
+  pthread_cond_signal(&pa_cond);
+  pthread_mutex_unlock(&pa_mutex);
+
+  return 0;
+}
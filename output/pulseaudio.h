@@ -0,0 +1,52 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PULSEAUDIO_H
+#define PULSEAUDIO_H
+
+#include "../speaker.h"
+
+
+struct pulse_config {
+    const char *sink;
+    const char *stream_name;
+    int low_latency;
+    /* 流中交错的声道数，为 0 时按单声道 */
+    uint32_t channels;
+};
+
+int pulse_output_init(const struct pulse_config *cfg);
+
+void pulse_output_deinit();
+
+int pulse_output_send(pcm_header_t *header, const uint8_t *data);
+
+int pulse_output_format(audio_rate_t rate, audio_bits_t bits);
+
+uint32_t pulse_output_latency();
+
+uint32_t pulse_output_space();
+
+uint32_t pulse_output_queued();
+
+int pulse_output_flush();
+
+int pulse_output_suspend(int suspend);
+
+#endif
@@ -3,6 +3,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <math.h>
+#include "config.h"
 #include "common/log.h"
 #include "common/event/select.h"
 #include "common/event/udp.h"
@@ -15,11 +16,20 @@
 #include "speaker_multicast.h"
 #include "common/utils.h"
 #include "speaker_receiver.h"
+#include "speaker_pcm.h"
+#include "speaker_pipeline.h"
+#include "speaker_relay.h"
+#include "speaker_schedule.h"
+#include "speaker_status.h"
+#include "speaker_pool.h"
+#include "speaker_recorder.h"
+#include "dsp/convolver.h"
+#include "dsp/workers.h"
 #include "output/raw.h"
 
 
 #if PULSEAUDIO_ENABLE
-#include "pulseaudio.h"
+#include "output/pulseaudio.h"
 #endif
 
 #if ALSA_ENABLE
@@ -30,6 +40,10 @@
 #include "pcap.h"
 #endif
 
+#if XDP_ENABLE
+#include "input/xdp.h"
+#endif
+
 LOG_TAG_DECLR("speaker");
 
 
@@ -45,10 +59,30 @@ static char *config_file = "/etc/castspeaker/daemon.conf";
 static char *ivshmem_device = NULL;
 enum output_type output_mode = OUTPUT_TYPE_RAW;
 static output_send_fn output_fn;
+static set_audio_format_fn format_fn = NULL;
+static output_latency_fn latency_fn = NULL;
+static output_flush_fn flush_fn = NULL;
+static output_suspend_fn suspend_fn = NULL;
+static output_space_fn space_fn = NULL;
 static char *alsa_device = "default";
 static char *pa_sink = NULL;
 static char *pa_stream_name = "Audio";
+static int low_latency = 0;
+static uint32_t output_rate = 0;
+static uint32_t output_channels = 1;
+static uint32_t dsp_workers = 0;
+static uint32_t speaker_group = PCM_V2_GROUP_ANY;
+static uint32_t standby_after = 0;
+static char *fir_file = NULL;
+static char *recorder_file = RECORDER_DEFAULT_PATH;
+#if XDP_ENABLE
+static char *xdp_iface = NULL;
+static uint32_t xdp_queue = 0;
+#endif
 static interface_t iface = {0};
+static interface_t relay_iface = {0};
+static struct relay_assign relay_assign[RELAY_MAX_SPEAKERS];
+static uint32_t relay_assign_len = 0;
 
 uint32_t gen_id() {
 #if WIN32
@@ -59,7 +93,7 @@ uint32_t gen_id() {
 }
 
 static void show_help(const char *arg0, int no) {
-  printf("Usage: %s [-I <id>] [-p <port>] [-i <iface>] [-g <group>]\n", arg0);
+  printf("Usage: %s [-I <id>] [-p <port>] [-i <iface>] [-g <group>] [-L]\n", arg0);
   printf("\n");
   printf("         All command line options are optional. Default is to use\n");
   printf("         multicast with group address " DEFAULT_MULTICAST_GROUP ", port %d.\n", DEFAULT_MULTICAST_PORT);
@@ -76,6 +110,37 @@ static void show_help(const char *arg0, int no) {
   printf("         -d <device>               : ALSA device name. 'default' if not specified.\n");
   printf("         -s <sink name>            : Pulseaudio sink name.\n");
   printf("         -n <stream name>          : Pulseaudio stream name/description.\n");
+  printf("         -c <channels>             : Interleaved channels in the stream. Default is 1.\n");
+  printf("         -w <workers>              : DSP worker threads besides the audio thread. 0\n");
+  printf("                                     processes all channels inline. Default uses\n");
+  printf("                                     every core, at most one thread per channel.\n");
+  printf("         -U <group>                : Only play the stream of speaker group <group>.\n");
+  printf("                                     Default plays every group.\n");
+  printf("         -L                        : Low latency mode. Use the smallest output buffer\n");
+  printf("                                     and busy poll the sockets. The control sockets\n");
+  printf("                                     also need sysctl net.core.busy_poll=50.\n");
+  printf("         -r <rate>                 : Resample all streams to <rate> Hz for the output\n");
+  printf("                                     device. Default is to play the stream rate.\n");
+  printf("         -S <seconds>              : Put the output to standby after <seconds> of\n");
+  printf("                                     silence. Default is never.\n");
+  printf("         -F <file>                 : Room correction FIR filter, one coefficient\n");
+  printf("                                     per line. A '# rate <hz>' line gives its rate,\n");
+  printf("                                     default is the -r rate. Streams played at other\n");
+  printf("                                     rates bypass the filter.\n");
+  printf("         -B <taps>                 : Benchmark the FIR engine with <taps> and exit.\n");
+  printf("         -R <iface>                : Relay mode. Re-distribute the stream to the\n");
+  printf("                                     speakers on local iface <iface>.\n");
+  printf("         -A <id>=<ch>[,...]        : Relay only channel <ch> to speaker <id>. Speakers\n");
+  printf("                                     not listed receive every channel.\n");
+  printf("         -G <group>                : Data multicast group. In relay mode the stream is\n");
+  printf("                                     forwarded to it, otherwise the speaker joins it.\n");
+  printf("         -X <iface>[:<queue>]      : Receive the stream with AF_XDP on <iface> rx\n");
+  printf("                                     queue <queue>. Default queue is 0.\n");
+  printf("         -D <file>|none            : Flight recorder ring file. Default is\n");
+  printf("                                     " RECORDER_DEFAULT_PATH ". SIGUSR1 saves a copy\n");
+  printf("                                     next to it. Must not be a symbolic link.\n");
+  printf("         -E <file>                 : Print a recorder file as a timeline and exit.\n");
+  printf("         -P <file>                 : Convert a recorder file to pcap on stdout and exit.\n");
   printf("         -l <level>                : Log level. Default is 'info'.\n");
   printf("\n");
   exit(no);
@@ -83,6 +148,116 @@ static void show_help(const char *arg0, int no) {
 
 void castspeaker_deinit();
 
+static void status_print(FILE *out, const char *arg) {
+  struct meter_levels levels;
+  struct pool_stats pool;
+  uint32_t ch;
+
+  pipeline_levels(&levels);
+  pool_get_stats(&pool);
+
+  fprintf(out, "speaker %u\n", speaker_id);
+  fprintf(out, "server %s\n", server_addr.type ? addr_ntop(&server_addr) : "-");
+  struct receiver_stats rx;
+  receiver_get_stats(&rx);
+  fprintf(out, "rx v%d v1 %u v2 %u lost %u late %u resync %u concealed %u frames\n", receiver_wire_version(),
+          rx.v1_packets, rx.v2_packets, rx.lost, rx.late, rx.resyncs, rx.concealed_frames);
+  fprintf(out, "drops data %lld detect %lld\n", (long long) receiver_drops(), (long long) mcast_drops());
+#if XDP_ENABLE
+  struct xdp_stats xdp;
+  if (xdp_input_stats(&xdp) == 0) {
+    fprintf(out, "xdp packets %llu dropped %llu fill empty %llu%s\n", (unsigned long long) xdp.packets,
+            (unsigned long long) xdp.dropped, (unsigned long long) xdp.fill_empty, xdp.zero_copy ? " zero copy" : "");
+  }
+#endif
+  fprintf(out, "pool %u/%u high %u exhausted %u\n", pool.in_use, pool.depth, pool.high_water, pool.exhausted);
+  fprintf(out, "schedule misses %u\n", schedule_misses());
+  for (ch = 0; ch < levels.channels; ch++) {
+    fprintf(out, "ch%u peak %.1f rms %.1f clips %u\n", ch, levels.peak[ch], levels.rms[ch], levels.clips[ch]);
+  }
+}
+
+static void status_fir(FILE *out, const char *arg) {
+  if (arg == NULL || *arg == '\0') {
+    fprintf(out, "fir %u taps\n", pipeline_fir_taps());
+    return;
+  }
+
+  if (pipeline_load_fir(strcmp(arg, "off") == 0 ? NULL : arg) != 0) {
+    fprintf(out, "fir load %s failed\n", arg);
+    return;
+  }
+  fprintf(out, "fir %s\n", arg);
+}
+
+static void fir_benchmark(const char *arg) {
+  static const uint32_t rates[] = {48000, 96000, 192000};
+  size_t taps = strtol(arg, NULL, 10), i;
+
+  if (taps == 0 || taps > CONVOLVER_MAX_TAPS) {
+    printf("error fir taps: %s\n", arg);
+    exit(EERR_ARG);
+  }
+
+  for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+    printf("%u taps @ %uHz: %.1f channels per core\n", (uint32_t) taps, rates[i],
+           convolver_bench(taps, rates[i], CONVOLVER_BLOCK));
+  }
+  exit(0);
+}
+
+/**
+ * 解析 -A id=channel[,id=channel...]，可以重复使用
+ */
+static int relay_parse_assign(const char *arg) {
+  char *end;
+  long id, channel;
+
+  while (*arg) {
+    id = strtol(arg, &end, 10);
+    if (end == arg || *end != '=') return -1;
+    arg = end + 1;
+    channel = strtol(arg, &end, 10);
+    if (end == arg || channel < 0 || channel > UINT8_MAX) return -1;
+    if (relay_assign_len >= RELAY_MAX_SPEAKERS) return -1;
+
+    relay_assign[relay_assign_len].id = (speaker_id_t) id;
+    relay_assign[relay_assign_len].channel = (int) channel;
+    relay_assign_len++;
+
+    if (*end == ',') end++;
+    else if (*end) return -1;
+    arg = end;
+  }
+  return 0;
+}
+
+/**
+ * 跳转时先清空 pipeline 中的残留，再清空输出
+ */
+static int seek_flush() {
+  pipeline_flush();
+  return flush_fn ? flush_fn() : 0;
+}
+
+static void status_dump(FILE *out, const char *arg) {
+  char saved[300];
+
+  if (recorder_dump(arg && *arg ? arg : NULL, saved, sizeof(saved)) != 0) {
+    fprintf(out, "dump failed\n");
+    return;
+  }
+  fprintf(out, "%s\n", saved);
+}
+
+static void status_timeline(FILE *out, const char *arg) {
+  recorder_timeline(out, arg ? strtol(arg, NULL, 10) : 100);
+}
+
+static void signal_dump(int signum) {
+  recorder_dump_async();
+}
+
 void signal_handle(int signum) {
   LOGD("SIGNAL %d", signum);
   castspeaker_deinit();
@@ -99,9 +274,9 @@ int main(int argc, char *argv[]) {
   // Command line options
 #ifndef ESP32
 #if PULSEAUDIO_ENABLE
-  output_mode = Pulseaudio;
+  output_mode = OUTPUT_TYPE_PULSEAUDIO;
 #elif ALSA_ENABLE
-  output_mode = Alsa;
+  output_mode = OUTPUT_TYPE_ALSA;
 #else
   output_mode = OUTPUT_TYPE_RAW;
 #endif
@@ -111,6 +286,9 @@ int main(int argc, char *argv[]) {
   char *interface_name = NULL;
   char *default_iface_name = NULL;
   char *group_ip = NULL;
+  char *relay_iface_name = NULL;
+  char *data_group_ip = NULL;
+  static addr_t data_group = {0};
   sa_family_t family = AF_INET;
   static addr_t multicast_group = {0};
   static uint16_t multicast_port = DEFAULT_MULTICAST_PORT;
@@ -119,7 +297,7 @@ int main(int argc, char *argv[]) {
   log_add_filter("queue", LOG_WARN);
   log_add_filter("event", LOG_WARN);
 
-  while ((opt = getopt(argc, argv, "i:g:p:o:d:s:n:l:I:6h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:g:p:o:d:s:n:l:I:r:R:A:G:S:F:B:X:D:E:P:c:U:w:6Lh")) != -1) {
     switch (opt) {
       case 'l': // log level
         if (0 > log_set_level_from_string(optarg)) {
@@ -152,6 +330,53 @@ int main(int argc, char *argv[]) {
         }
         group_ip = strdup(optarg);
         break;
+      case 'S':
+        standby_after = strtol(optarg, NULL, 10);
+        break;
+      case 'F':
+        fir_file = strdup(optarg);
+        break;
+      case 'B':
+        fir_benchmark(optarg);
+        break;
+      case 'D':
+        recorder_file = strdup(optarg);
+        break;
+      case 'E':
+      case 'P':
+        exit(recorder_export(optarg, stdout, opt == 'P') == 0 ? 0 : EERR_ARG);
+      case 'X':
+#if XDP_ENABLE
+        xdp_iface = strdup(optarg);
+        if (strchr(xdp_iface, ':')) {
+          xdp_queue = strtol(strchr(xdp_iface, ':') + 1, NULL, 10);
+          *strchr(xdp_iface, ':') = '\0';
+        }
+        break;
+#else
+        printf("AF_XDP is not enabled in this build\n");
+        exit(EERR_ARG);
+#endif
+      case 'R':
+        if (strlen(optarg) > IF_NAMESIZE) {
+          printf("Too long iface name '%s'\n", optarg);
+          exit(EERR_ARG);
+        }
+        relay_iface_name = strdup(optarg);
+        break;
+      case 'A':
+        if (relay_parse_assign(optarg) != 0) {
+          printf("error relay channel assignment: %s\n", optarg);
+          show_help(argv[0], EERR_ARG);
+        }
+        break;
+      case 'G':
+        if (0 != is_multicast_addr(optarg)) {
+          printf("error multicast address: %s", optarg);
+          show_help(argv[0], EERR_ARG);
+        }
+        data_group_ip = strdup(optarg);
+        break;
       case 'o':
         if (strcmp(optarg, "pulse") == 0) output_mode = OUTPUT_TYPE_PULSEAUDIO;
         else if (strcmp(optarg, "alsa") == 0) output_mode = OUTPUT_TYPE_ALSA;
@@ -165,10 +390,42 @@ int main(int argc, char *argv[]) {
 //        alsa_device = strdup(optarg);
         break;
       case 's':
-//        pa_sink = strdup(optarg);
+        pa_sink = strdup(optarg);
         break;
       case 'n':
-//        pa_stream_name = strdup(optarg);
+        pa_stream_name = strdup(optarg);
+        break;
+      case 'L':
+        low_latency = 1;
+        break;
+      case 'c':
+        output_channels = strtol(optarg, NULL, 10);
+        if (output_channels == 0 || output_channels > PIPELINE_MAX_CHANNELS) {
+          printf("error channels: %s\n", optarg);
+          show_help(argv[0], EERR_ARG);
+        }
+        break;
+      case 'w':
+        dsp_workers = strtol(optarg, NULL, 10);
+        if (dsp_workers > WORKERS_MAX) {
+          printf("error workers: %s\n", optarg);
+          show_help(argv[0], EERR_ARG);
+        }
+        if (dsp_workers == 0) dsp_workers = WORKERS_INLINE;
+        break;
+      case 'U':
+        speaker_group = strtol(optarg, NULL, 10);
+        if (speaker_group == PCM_V2_GROUP_ANY || speaker_group > UINT8_MAX) {
+          printf("error speaker group: %s\n", optarg);
+          show_help(argv[0], EERR_ARG);
+        }
+        break;
+      case 'r':
+        output_rate = strtol(optarg, NULL, 10);
+        if (!rate_from_hz(output_rate)) {
+          printf("error output rate: %s\n", optarg);
+          show_help(argv[0], EERR_ARG);
+        }
         break;
       case 'h':
         show_help(argv[0], 0);
@@ -231,26 +488,73 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (data_group_ip) {
+    addr_stoa(&data_group, data_group_ip);
+    free(data_group_ip);
+    if (data_group.type != family) {
+      printf("The data group ip family mismatch, please check -6 and try again.\n");
+      show_help(argv[0], EERR_ARG);
+    }
+  }
+
+  if (relay_iface_name) {
+    if (get_interface(family, &relay_iface, relay_iface_name) < 0) {
+      printf("Invalid relay iface: %s\n", relay_iface_name);
+      exit(EERR_ARG);
+    }
+    free(relay_iface_name);
+  }
+
   speaker_id = spid_isset ? speaker_id : gen_id();
   LOGI("speaker id: %u", speaker_id);
 
   signal(SIGINT, signal_handle);
   signal(SIGSEGV, signal_handle);
   signal(SIGTERM, signal_handle);
+#ifdef SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+#endif
 #ifdef SIGKILL
   signal(SIGKILL, signal_handle);
 #endif
 #ifdef SIGQUIT
   signal(SIGQUIT, signal_handle);
 #endif
+#ifdef SIGUSR1
+  signal(SIGUSR1, signal_dump);
+#endif
+
+  recorder_init(strcmp(recorder_file, "none") == 0 ? NULL : recorder_file);
 
   LOGI("Starting receiver");
 
   // initialize output
   switch (output_mode) {
     case OUTPUT_TYPE_PULSEAUDIO:
+#if PULSEAUDIO_ENABLE
+      printf("Using pulseaudio output\n");
+      struct pulse_config pulse_cfg = {
+        .sink = pa_sink,
+        .stream_name = pa_stream_name,
+        .low_latency = low_latency,
+        .channels = output_channels,
+      };
+      if (pulse_output_init(&pulse_cfg) != 0) {
+        printf("Pulseaudio output init failed.\n");
+        exit(EERR_ARG);
+      }
+      output_fn = pulse_output_send;
+      format_fn = pulse_output_format;
+      latency_fn = pulse_output_latency;
+      flush_fn = pulse_output_flush;
+      suspend_fn = pulse_output_suspend;
+      space_fn = pulse_output_space;
+      recorder_set_queue(pulse_output_queued);
+      break;
+#else
       printf("Pulseaudio not support yet.\n");
       exit(EERR_ARG);
+#endif
     case OUTPUT_TYPE_ALSA:
       printf("ALSA not support yet.\n");
       exit(EERR_ARG);
@@ -267,7 +571,43 @@ int main(int argc, char *argv[]) {
 
   SOCKET_INIT();
 
-  event_init(EVENT_TYPE_SELECT, EVENT_PROTOCOL_UDP, 4096, 100);
+  event_init(EVENT_TYPE_SELECT, EVENT_PROTOCOL_UDP, PACKAGE_MAX_SIZE, 100);
+
+  // 低延迟模式抖动缓冲小，用 busy poll 换取更短的唤醒延迟
+  struct socket_tune socket_cfg = {
+    .rcvbuf = SOCKET_RCVBUF_FOR(low_latency ? SOCKET_JITTER_LOW_USEC : SOCKET_JITTER_USEC),
+    .busy_poll_usec = low_latency ? SOCKET_BUSY_POLL_USEC : 0,
+    .dscp = SOCKET_DSCP_EF,
+    .priority = SOCKET_PRIORITY_AUDIO,
+  };
+
+  struct schedule_config schedule_cfg = {
+    .output_cb = output_fn,
+    .latency_cb = latency_fn,
+    .flush_cb = seek_flush,
+    .space_cb = space_fn,
+    .channels = output_channels,
+  };
+  schedule_init(&schedule_cfg);
+
+  struct pipeline_config pipeline_cfg = {
+    .output_cb = schedule_send,
+    .format_cb = format_fn,
+    .out_rate = output_rate,
+    .channels = output_channels,
+    .mtu = PACKAGE_MAX_SIZE,
+    .standby_after = standby_after,
+    .suspend_cb = suspend_fn,
+    .workers = dsp_workers,
+  };
+  if (pipeline_init(&pipeline_cfg) != 0) {
+    printf("Pipeline init failed.\n");
+    exit(EERR_ARG);
+  }
+  if (fir_file && pipeline_load_fir(fir_file) != 0) {
+    printf("Invalid fir file: %s\n", fir_file);
+    sexit(EERR_ARG);
+  }
 
   // init receiver
 
@@ -275,9 +615,51 @@ int main(int argc, char *argv[]) {
     .family = family,
     .ip = interface_name ? &iface.ip : NULL,
     .port = 0,
-    .output_cb = output_fn,
+    .output_cb = pipeline_send,
+    .format_cb = pipeline_format,
+    .format_at_cb = pipeline_format_at,
+    .sequence_cb = pipeline_sequence,
+    .latency_cb = latency_fn,
+    .mtu = PACKAGE_MAX_SIZE,
+    .pool_depth = BUFFER_LIST_SIZE,
+    .group = data_group.type && !relay_iface.ip.type ? &data_group : NULL,
+    .forward_cb = relay_iface.ip.type ? relay_forward_data : NULL,
+    .tune = &socket_cfg,
+    .channels = output_channels,
+    .group_id = (uint8_t) speaker_group,
+    .version = PCM_WIRE_VERSION,
   };
   receiver_init(&receiver_cfg);
+  recorder_set_receiver(receiver_cfg.group ? receiver_cfg.group : receiver_cfg.ip, receiver_port());
+
+#if XDP_ENABLE
+  if (xdp_iface) {
+    struct xdp_config xdp_cfg = {
+      .ifname = xdp_iface,
+      .queue = xdp_queue,
+      .port = receiver_port(),
+      .prog_path = access(XDP_PROG_PATH, R_OK) == 0 ? XDP_PROG_PATH : "xdp_kern.o",
+    };
+    if (xdp_input_init(&xdp_cfg) != 0) LOGW("AF_XDP unavailable, receive with socket");
+  }
+#endif
+
+  if (relay_iface.ip.type) {
+    struct relay_config relay_cfg = {
+      .iface = &relay_iface,
+      .multicast_group = multicast_group.type ? &multicast_group : NULL,
+      .multicast_port = multicast_port,
+      .data_group = data_group.type ? &data_group : NULL,
+      .data_port = 0,
+      .assign = relay_assign,
+      .assign_len = relay_assign_len,
+      .tune = &socket_cfg,
+    };
+    if (relay_init(&relay_cfg) != 0) {
+      printf("Relay init failed.\n");
+      sexit(EERR_ARG);
+    }
+  }
 
   struct multicast_config multicast_cfg = {
     .id = speaker_id,
@@ -285,13 +667,21 @@ int main(int argc, char *argv[]) {
     .iface = &iface,
     .multicast_port = multicast_port,
     .data_port = 0,
-    .rate = {RATE_44100, RATE_48000},
+    .rate = {RATE_44100, RATE_48000, RATE_88200, RATE_96000, RATE_176400, RATE_192000},
     .bits = {BIT_16, BIT_24, BIT_32},
+    .forward_cb = relay_iface.ip.type ? relay_forward_detect : NULL,
+    .tune = &socket_cfg,
   };
   mcast_init(&multicast_cfg);
 
   if (interface_name) free(interface_name);
 
+  status_register("status", "Speaker, buffer and per-channel level status.", status_print);
+  status_register("fir", "Show taps, load a new FIR file or 'off'.", status_fir);
+  status_register("dump", "Save the flight recorder ring, as [name] in the recorder directory if given.", status_dump);
+  status_register("timeline", "Print the last [n] flight recorder records, default 100.", status_timeline);
+  status_init(sock_path);
+
   while (!exit_thread_flag) {
     event_start();
   }
@@ -307,9 +697,20 @@ void castspeaker_deinit() {
 
   event_deinit();
 
+  status_deinit();
+  relay_deinit();
+#if XDP_ENABLE
+  xdp_input_deinit();
+#endif
   receiver_deinit();
   mcast_deinit();
+  pipeline_deinit();
+
+#if PULSEAUDIO_ENABLE
+  if (output_mode == OUTPUT_TYPE_PULSEAUDIO) pulse_output_deinit();
+#endif
 
+  recorder_deinit();
   SOCKET_DEINIT();
 }
 
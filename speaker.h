@@ -12,6 +12,7 @@
 
 #define MAXLINE 80
 #define BUFFER_LIST_SIZE 16
+#define PACKAGE_MAX_SIZE 4096
 
 #include "common/audio.h"
 
@@ -22,6 +23,8 @@ enum output_type {
     OUTPUT_TYPE_PULSEAUDIO
 };
 
+typedef void (*forward_fn)(const void *package, uint32_t len);
+
 extern pcm_header_t recv_buf[BUFFER_LIST_SIZE];
 extern uint32_t ctrl_mtu;
 
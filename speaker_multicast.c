@@ -22,6 +22,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include "speaker_receiver.h"
+#include "speaker_pcm.h"
 #include "common/utils.h"
 #include "common/connection.h"
 #include "common/event/select.h"
@@ -44,6 +45,8 @@ static uint16_t multicast_port = 0;
 static detect_request_t header = {0};
 
 static connection_t conn = DEFAULT_CONNECTION_UDP_INIT;
+static forward_fn forward_cb = NULL;
+static struct socket_tune tune = {.dscp = -1, .priority = -1};
 
 LOG_TAG_DECLR("speaker");
 
@@ -66,7 +69,7 @@ socket_t create_multicast_socket() {
   socklen_t sock_len = 0;
   struct sockaddr_storage group_addr = {0};
   struct ipv6_mreq imreq = {0};
-  int optlevel = 0, optname = 0, dont_loop = 0;
+  int optlevel = 0, optname = 0, dont_loop = 0, reuse = 1;
   sa_family_t af = iface.ip.type;
   addr_t addr = {.type = af, .ipv6 = IN6ADDR_ANY_INIT};
 
@@ -78,6 +81,9 @@ socket_t create_multicast_socket() {
 
   sock_len = set_sockaddr(&group_addr, &addr, multicast_port);
 
+  // relay 在下游网卡上监听同一个端口
+  setsockopt(cast_sockfd, SOL_SOCKET, SO_REUSEADDR, (void *) &reuse, sizeof(reuse));
+
   if ((bind(cast_sockfd, (struct sockaddr *) &group_addr, sock_len)) < 0) {
     LOGF("detect bind error: %m");
     sexit(ERROR_SOCKET);
@@ -139,6 +145,8 @@ socket_t create_multicast_socket() {
     sexit(ERROR_SOCKET);
   }
 
+  socket_tune(cast_sockfd, af, &tune);
+
   return cast_sockfd;
 }
 
@@ -158,6 +166,8 @@ int sp_multicast_read(connection_t *c, const struct sockaddr_storage *src, sockl
 
   save_server_info((detect_response_t *) package);
 
+  if (forward_cb) forward_cb(package, len);
+
   return 0;
 }
 
@@ -221,7 +231,7 @@ int mcast_init(struct multicast_config *cfg) {
   header.addr = iface.ip;
   header.mac = iface.mac;
 
-  header.ver = 1;
+  header.ver = PCM_WIRE_VERSION;
   header.id = cfg->id;
   header.connected = DETECT_SERVER_DISCONECTED;
   header.data_port = cfg->data_port ? cfg->data_port : DEFAULT_RECEIVER_PORT;
@@ -230,6 +240,8 @@ int mcast_init(struct multicast_config *cfg) {
   MASK_ARR_PACK(header.bits_mask, cfg->bits, BITSMASK_SIZE);
 
   multicast_port = cfg->multicast_port ? cfg->multicast_port : DEFAULT_MULTICAST_PORT;
+  forward_cb = cfg->forward_cb;
+  if (cfg->tune) tune = *cfg->tune;
 
   conn.family = iface.ip.type;
   conn.read_cb = sp_multicast_read;
@@ -245,6 +257,10 @@ int mcast_init(struct multicast_config *cfg) {
   return 0;
 }
 
+int64_t mcast_drops() {
+  return socket_drops(conn.read_fd, iface.ip.type);
+}
+
 void mcast_deinit() {
   LOGT("multicast deinit");
 
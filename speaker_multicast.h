@@ -23,6 +23,7 @@
 #include "common/common.h"
 #include "common/audio.h"
 #include "speaker.h"
+#include "speaker_socket.h"
 
 
 struct multicast_config {
@@ -33,6 +34,8 @@ struct multicast_config {
     uint16_t data_port;
     audio_rate_t rate[RATEMASK_SIZE];
     audio_bits_t bits[BITSMASK_SIZE];
+    forward_fn forward_cb;
+    const struct socket_tune *tune;
 };
 
 extern addr_t server_addr;
@@ -42,5 +45,7 @@ int mcast_init(struct multicast_config *cfg);
 
 void mcast_deinit();
 
+int64_t mcast_drops();
+
 
 #endif
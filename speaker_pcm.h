@@ -0,0 +1,185 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_PCM_H
+#define SPEAKER_PCM_H
+
+#include <stddef.h>
+#include "speaker.h"
+
+#define PCM_WIRE_VERSION 2
+
+#define PCM_V2_MAGIC 0xC2
+#define PCM_V2_HEADER_SIZE 16
+/* group 为 0 的包发给所有分组 */
+#define PCM_V2_GROUP_ANY 0
+
+/* 序号倒退或者跳跃超过这个包数，视为服务端重置了序号 */
+#define PCM_SEQ_RESYNC_JUMP 1024
+/* 连续这么多个迟到包，视为服务端重置了序号 */
+#define PCM_SEQ_RESYNC_LATE 8
+
+enum pcm_v2_flags {
+    /* 新的流或者服务端重置了序号，不统计丢包 */
+    PCM_V2_FLAG_START = 0x01,
+    /* 负载是一个 v1 的控制包，seq 为命令生效的第一个数据包的序号 */
+    PCM_V2_FLAG_CONTROL = 0x02,
+};
+
+/**
+ * v2 数据包头，固定 16 字节，多字节字段为网络字节序。负载从 16 字节处开始，
+ * 缓冲区按 16 字节对齐时负载也是对齐的，不受 PACKAGE_PACKED 影响
+ *  0       1       2       3       4       5       6               8               12              16
+ *  +-------+-------+-------+-------+-------+-------+---------------+---------------+---------------+
+ *  | 0xC2  | flags | group |channel| rate  | bits  |   len (u16)   |   seq (u32)   |   ts (u32)    |
+ *  +-------+-------+-------+-------+-------+-------+---------------+---------------+---------------+
+ * ts 为第一帧的媒体时间，单位是流采样率下的帧数
+ */
+typedef struct {
+    uint8_t magic;
+    uint8_t flags;
+    uint8_t group;
+    uint8_t channel;
+    uint8_t rate;
+    uint8_t bits;
+    uint16_t len;
+    uint32_t seq;
+    uint32_t ts;
+} pcm_header_v2_t;
+
+_Static_assert(sizeof(pcm_header_v2_t) == PCM_V2_HEADER_SIZE, "pcm v2 header must be 16 bytes");
+
+#define IS_PCM_V2_PACKAGE(p, len) ((len) >= PCM_V2_HEADER_SIZE && ((const uint8_t *) (p))[0] == PCM_V2_MAGIC)
+
+static inline uint16_t pcm_load_be16(const uint8_t *p) {
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t pcm_load_be32(const uint8_t *p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static inline void pcm_store_be16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static inline void pcm_store_be32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static inline void pcm_v2_encode(uint8_t *p, const pcm_header_v2_t *h) {
+  p[offsetof(pcm_header_v2_t, magic)] = PCM_V2_MAGIC;
+  p[offsetof(pcm_header_v2_t, flags)] = h->flags;
+  p[offsetof(pcm_header_v2_t, group)] = h->group;
+  p[offsetof(pcm_header_v2_t, channel)] = h->channel;
+  p[offsetof(pcm_header_v2_t, rate)] = h->rate;
+  p[offsetof(pcm_header_v2_t, bits)] = h->bits;
+  pcm_store_be16(p + offsetof(pcm_header_v2_t, len), h->len);
+  pcm_store_be32(p + offsetof(pcm_header_v2_t, seq), h->seq);
+  pcm_store_be32(p + offsetof(pcm_header_v2_t, ts), h->ts);
+}
+
+/**
+ * 在原缓冲区上解码，逐字节读取，不要求 p 对齐
+ */
+static inline void pcm_v2_decode(pcm_header_v2_t *h, const uint8_t *p) {
+  h->magic = p[offsetof(pcm_header_v2_t, magic)];
+  h->flags = p[offsetof(pcm_header_v2_t, flags)];
+  h->group = p[offsetof(pcm_header_v2_t, group)];
+  h->channel = p[offsetof(pcm_header_v2_t, channel)];
+  h->rate = p[offsetof(pcm_header_v2_t, rate)];
+  h->bits = p[offsetof(pcm_header_v2_t, bits)];
+  h->len = pcm_load_be16(p + offsetof(pcm_header_v2_t, len));
+  h->seq = pcm_load_be32(p + offsetof(pcm_header_v2_t, seq));
+  h->ts = pcm_load_be32(p + offsetof(pcm_header_v2_t, ts));
+}
+
+/**
+ * v2 数据包的序号跟踪，只在接收路径上访问
+ */
+typedef struct {
+    int valid;
+    uint32_t next_seq;
+    uint32_t next_ts;
+    uint32_t late_run;
+} pcm_seq_t;
+
+enum pcm_seq_result {
+    PCM_SEQ_IN_ORDER = 0,
+    /* 中间有丢包，需要补静音 */
+    PCM_SEQ_GAP,
+    /* 迟到或重复的包，丢弃 */
+    PCM_SEQ_LATE,
+    /* 序号大幅跳变或者连续迟到，从这个包重新开始计数 */
+    PCM_SEQ_RESYNC,
+};
+
+/**
+ * @param count GAP 时为丢失的包数，LATE 时为落后的包数
+ * @param lost_frames GAP 时按媒体时间计算的丢失帧数
+ */
+static inline enum pcm_seq_result pcm_seq_next(pcm_seq_t *s, uint32_t seq, uint32_t ts, uint32_t frames, int start,
+                                               uint32_t *count, int64_t *lost_frames) {
+  int32_t gap = (int32_t) (seq - s->next_seq);
+  enum pcm_seq_result r = PCM_SEQ_IN_ORDER;
+
+  *count = 0;
+  *lost_frames = 0;
+
+  if (!s->valid || start) {
+    s->valid = 1;
+  } else if (gap < -PCM_SEQ_RESYNC_JUMP || gap > PCM_SEQ_RESYNC_JUMP) {
+    r = PCM_SEQ_RESYNC;
+  } else if (gap < 0) {
+    if (++s->late_run < PCM_SEQ_RESYNC_LATE) {
+      *count = -gap;
+      return PCM_SEQ_LATE;
+    }
+    r = PCM_SEQ_RESYNC;
+  } else if (gap > 0) {
+    *count = gap;
+    *lost_frames = (int32_t) (ts - s->next_ts);
+    if (*lost_frames < 0) *lost_frames = 0;
+    r = PCM_SEQ_GAP;
+  }
+
+  s->late_run = 0;
+  s->next_seq = seq + 1;
+  s->next_ts = ts + frames;
+
+  return r;
+}
+
+/**
+ * 补静音时下一块的字节数，按整帧切分，不超过 max_bytes。
+ * frame_size 为所有声道一帧的字节数，块在帧中间结束会使之后的声道错位
+ * @return 0 表示 max_bytes 放不下一帧
+ */
+static inline uint32_t pcm_conceal_bytes(int64_t frames, uint32_t frame_size, uint32_t max_bytes) {
+  uint32_t chunk = frame_size ? max_bytes / frame_size : 0;
+
+  if (frames <= 0 || chunk == 0) return 0;
+  return (uint32_t) (frames < chunk ? frames : chunk) * frame_size;
+}
+
+#endif
@@ -0,0 +1,693 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "speaker_pipeline.h"
+#include "dsp/convolver.h"
+#include "dsp/format.h"
+#include "dsp/resample.h"
+#include "dsp/silence.h"
+#include "dsp/workers.h"
+#include "speaker_recorder.h"
+
+typedef struct pipeline {
+    audio_rate_t rate;
+    audio_bits_t sample_bits;
+    audio_rate_t out_rate;
+    int bits;
+    size_t max_frames;
+    resampler_t *resampler;
+    convolver_t *convolver;
+    uint32_t fir_gen;
+    int fir_idle;
+    int rejected;
+    uint64_t tail_usec;
+    float *in[PIPELINE_MAX_CHANNELS];
+    float *out[PIPELINE_MAX_CHANNELS];
+    uint8_t *pcm;
+} pipeline_t;
+
+struct pipeline_job {
+    pipeline_t *p;
+    const uint8_t *data;
+    size_t frames;
+    int meter;
+};
+
+static const audio_rate_t known_rates[] = {
+  RATE_44100, RATE_48000, RATE_88200, RATE_96000, RATE_176400, RATE_192000,
+};
+
+static struct pipeline_config pl_cfg = {0};
+static pipeline_t *active = NULL;
+
+/* 格式切换时新的 pipeline 在 pl_thread 中准备，音频路径只做指针交换 */
+static pthread_t pl_thread;
+static pthread_mutex_t pl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pl_cond = PTHREAD_COND_INITIALIZER;
+static int pl_running = 0;
+static int pl_requested = 0;
+static int pl_fir_requested = 0;
+static audio_rate_t pl_request_rate;
+static audio_bits_t pl_request_bits;
+static _Atomic(pipeline_t *) pending = NULL;
+static _Atomic(pipeline_t *) retired = NULL;
+
+#define PIPELINE_LATE_WINDOW 1024
+
+/*
+ * v2 的格式命令带有切换序号，序号到达时才切换；切换之后到达的、序号更早的旧格式包直接丢弃，
+ * 不会因为乱序来回切换。packet_seq 只在音频路径上访问
+ */
+static atomic_int switch_armed = 0;
+static atomic_uint switch_seq = 0;
+static uint32_t switched_seq = 0;
+static int switched = 0;
+static uint32_t packet_seq = 0;
+static int packet_seq_valid = 0;
+
+/* 滤波器更换后按当前格式重建 pipeline，fir_gen 用来识别旧的 pipeline */
+static pthread_mutex_t fir_mutex = PTHREAD_MUTEX_INITIALIZER;
+static float *fir_taps = NULL;
+static size_t fir_len = 0;
+static uint32_t fir_rate = 0;
+static atomic_uint fir_gen = 0;
+
+/* 正在播放的格式，rate << 8 | bits，0 表示还没有。滤波器在其它线程中按它重建 */
+static atomic_uint active_format = 0;
+
+static uint32_t silent_packets = 0;
+static uint64_t silent_usec = 0;
+static int standby = 0;
+
+static struct pipeline_job job;
+
+static meter_t meter;
+static struct meter_levels levels = {0};
+static pthread_mutex_t levels_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+LOG_TAG_DECLR("pipeline");
+
+__attribute__((weak)) void speaker_amp_standby(int standby) {
+}
+
+audio_rate_t rate_from_hz(uint32_t hz) {
+  size_t i;
+
+  for (i = 0; i < sizeof(known_rates) / sizeof(known_rates[0]); i++) {
+    if ((uint32_t) rate_name(known_rates[i]) == hz) return known_rates[i];
+  }
+  return 0;
+}
+
+static void pipeline_destroy(pipeline_t *p) {
+  uint32_t ch;
+
+  if (p == NULL) return;
+
+  resampler_destroy(p->resampler);
+  convolver_destroy(p->convolver);
+  for (ch = 0; ch < pl_cfg.channels; ch++) {
+    free(p->in[ch]);
+    free(p->out[ch]);
+  }
+  free(p->pcm);
+  free(p);
+}
+
+/**
+ * 按输入格式准备转换所需的重采样器、滤波器和缓冲区。
+ * 通常在 pl_thread 中提前调用；没有提前收到格式命令时由 pipeline_switch 在音频路径上调用
+ */
+static inline uint32_t pipeline_out_hz(audio_rate_t rate) {
+  return pl_cfg.out_rate ? pl_cfg.out_rate : (uint32_t) rate_name(rate);
+}
+
+static pipeline_t *pipeline_create(audio_rate_t rate, audio_bits_t bits) {
+  pipeline_t *p;
+  uint32_t ch, in_hz = rate_name(rate), out_hz = in_hz;
+  size_t out_frames;
+  int resample;
+
+  p = calloc(1, sizeof(pipeline_t));
+  if (p == NULL) return NULL;
+
+  p->rate = rate;
+  p->sample_bits = bits;
+  p->bits = bits_name(bits);
+  p->out_rate = rate;
+
+  // 滤波器只在设计它的采样率上使用，不对系数重采样
+  pthread_mutex_lock(&fir_mutex);
+  p->fir_gen = atomic_load(&fir_gen);
+  if (fir_taps && p->bits && fir_rate != pipeline_out_hz(rate)) {
+    LOGW("pipeline fir is %u Hz, bypass for %u Hz output", fir_rate, pipeline_out_hz(rate));
+  } else if (fir_taps && p->bits) {
+    p->convolver = convolver_create(fir_taps, fir_len, CONVOLVER_BLOCK, pl_cfg.channels);
+    if (p->convolver == NULL) LOGE("pipeline fir %u taps create failed", (uint32_t) fir_len);
+  }
+  pthread_mutex_unlock(&fir_mutex);
+
+  resample = pl_cfg.out_rate && pl_cfg.out_rate != in_hz && p->bits;
+  if (!resample && p->convolver == NULL) return p;
+
+  p->max_frames = pl_cfg.mtu / (pl_cfg.channels * (p->bits / 8));
+  out_frames = p->max_frames;
+  if (resample) {
+    out_hz = pl_cfg.out_rate;
+    p->out_rate = rate_from_hz(out_hz);
+    p->resampler = resampler_create(in_hz, out_hz, pl_cfg.channels, p->max_frames);
+    if (p->resampler == NULL) goto fail;
+    out_frames = resampler_max_output(p->resampler, p->max_frames);
+  }
+
+  for (ch = 0; ch < pl_cfg.channels; ch++) {
+    p->in[ch] = malloc(p->max_frames * sizeof(float));
+    if (p->in[ch] == NULL) goto fail;
+    if (!resample) continue;
+    p->out[ch] = malloc(out_frames * sizeof(float));
+    if (p->out[ch] == NULL) goto fail;
+  }
+  // 静音超过滤波器尾音的长度之后才可以跳过处理
+  if (p->convolver) p->tail_usec = (uint64_t) (convolver_tail(p->convolver) + out_frames) * 1000000 / out_hz;
+  p->pcm = malloc(out_frames * pl_cfg.channels * (p->bits / 8));
+  if (p->pcm == NULL) goto fail;
+
+  return p;
+
+fail:
+  LOGE("pipeline %d -> %u create failed", in_hz, out_hz);
+  pipeline_destroy(p);
+  return NULL;
+}
+
+/**
+ * 无法处理的格式也记录为一个 pipeline，同样格式的后续数据包直接丢弃，不再逐包重新创建
+ */
+static pipeline_t *pipeline_reject(const header_sample_t *sample) {
+  pipeline_t *p = calloc(1, sizeof(pipeline_t));
+
+  if (p == NULL) return NULL;
+
+  p->rate = sample->rate;
+  p->sample_bits = sample->bits;
+  p->rejected = 1;
+  p->fir_gen = atomic_load(&fir_gen);
+  LOGE("pipeline drop unsupported format %d/%d", rate_name(sample->rate), bits_name(sample->bits));
+  return p;
+}
+
+static inline int pipeline_match(const pipeline_t *p, const header_sample_t *sample) {
+  return p && p->rate == sample->rate && p->sample_bits == sample->bits;
+}
+
+/**
+ * 滤波器重建的结果只放进空的 pending，不覆盖为格式切换准备的 pipeline。
+ * 被占用时丢弃，切换到占用者时若滤波器已过期会重新请求重建
+ */
+static int pipeline_stage_fir(pipeline_t *p) {
+  pipeline_t *expected = NULL;
+
+  if (atomic_compare_exchange_strong(&pending, &expected, p)) return 0;
+
+  LOGD("pipeline pending busy, drop fir rebuild");
+  pipeline_destroy(p);
+  return -1;
+}
+
+static void pipeline_request_fir() {
+  pthread_mutex_lock(&pl_mutex);
+  pl_fir_requested = 1;
+  pthread_cond_signal(&pl_cond);
+  pthread_mutex_unlock(&pl_mutex);
+}
+
+static void *thread_pipeline(void *arg) {
+  pipeline_t *p, *old;
+  audio_rate_t rate;
+  audio_bits_t bits;
+  int format;
+
+  pthread_mutex_lock(&pl_mutex);
+  while (pl_running) {
+    old = atomic_exchange(&retired, NULL);
+    if (old) {
+      pthread_mutex_unlock(&pl_mutex);
+      pipeline_destroy(old);
+      pthread_mutex_lock(&pl_mutex);
+      continue;
+    }
+
+    if (!pl_requested && !pl_fir_requested) {
+      pthread_cond_wait(&pl_cond, &pl_mutex);
+      continue;
+    }
+
+    format = pl_requested;
+    if (format) {
+      rate = pl_request_rate;
+      bits = pl_request_bits;
+    } else {
+      // 滤波器更换只针对正在播放的格式，格式命令可能早已过期
+      rate = atomic_load(&active_format) >> 8;
+      bits = atomic_load(&active_format) & 0xFF;
+    }
+    pl_requested = 0;
+    pl_fir_requested = 0;
+    // 还没有收到过格式，滤波器等到第一次格式切换时再创建
+    if (!rate) continue;
+    pthread_mutex_unlock(&pl_mutex);
+
+    p = pipeline_create(rate, bits);
+    LOGD("pipeline staged %d/%d", rate_name(rate), bits_name(bits));
+    // 新的格式命令取代之前准备的任何 pipeline
+    if (format) pipeline_destroy(atomic_exchange(&pending, p));
+    else pipeline_stage_fir(p);
+
+    pthread_mutex_lock(&pl_mutex);
+  }
+  pthread_mutex_unlock(&pl_mutex);
+
+  pthread_exit(NULL);
+}
+
+static void pipeline_retire(pipeline_t *p) {
+  pipeline_t *old;
+
+  if (p == NULL) return;
+
+  old = atomic_exchange(&retired, p);
+  pthread_mutex_lock(&pl_mutex);
+  pthread_cond_signal(&pl_cond);
+  pthread_mutex_unlock(&pl_mutex);
+
+  /* 上一个还没被回收，说明格式切换过于频繁，直接在这里释放 */
+  if (old) pipeline_destroy(old);
+}
+
+int pipeline_init(const struct pipeline_config *cfg) {
+  LOGT("pipeline init");
+
+  if (cfg == NULL || cfg->output_cb == NULL) {
+    LOGE("pipeline output can not empty");
+    return -1;
+  }
+
+  pl_cfg = *cfg;
+  if (pl_cfg.channels == 0) pl_cfg.channels = 1;
+  if (pl_cfg.channels > PIPELINE_MAX_CHANNELS) {
+    LOGE("pipeline channels %u exceeds %d", pl_cfg.channels, PIPELINE_MAX_CHANNELS);
+    return -1;
+  }
+  if (pl_cfg.mtu == 0) pl_cfg.mtu = PACKAGE_MAX_SIZE;
+  meter_reset(&meter, pl_cfg.channels);
+  if (pl_cfg.out_rate && rate_from_hz(pl_cfg.out_rate) == 0) {
+    LOGE("pipeline unsupported output rate %u", pl_cfg.out_rate);
+    return -1;
+  }
+
+  if (workers_init(pl_cfg.workers, pl_cfg.channels) != 0) LOGW("pipeline process channels inline");
+
+  pl_running = 1;
+  if (0 != pthread_create(&pl_thread, NULL, thread_pipeline, NULL)) {
+    LOGE("pipeline thread create error: %m");
+    pl_running = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void pipeline_deinit() {
+  LOGT("pipeline deinit");
+
+  if (pl_running) {
+    pthread_mutex_lock(&pl_mutex);
+    pl_running = 0;
+    pthread_cond_signal(&pl_cond);
+    pthread_mutex_unlock(&pl_mutex);
+    pthread_join(pl_thread, NULL);
+  }
+  workers_deinit();
+
+  pipeline_destroy(atomic_exchange(&pending, NULL));
+  pipeline_destroy(atomic_exchange(&retired, NULL));
+  pipeline_destroy(active);
+  active = NULL;
+  resample_tables_free();
+
+  free(fir_taps);
+  fir_taps = NULL;
+  fir_len = 0;
+  fir_rate = 0;
+  atomic_store(&active_format, 0);
+}
+
+/**
+ * 只登记新的格式，真正的切换发生在第一个新格式的数据包到达时
+ */
+int pipeline_format(audio_rate_t rate, audio_bits_t bits) {
+  if (!pl_running) return -1;
+
+  pthread_mutex_lock(&pl_mutex);
+  pl_request_rate = rate;
+  pl_request_bits = bits;
+  pl_requested = 1;
+  pthread_cond_signal(&pl_cond);
+  pthread_mutex_unlock(&pl_mutex);
+
+  return 0;
+}
+
+int pipeline_format_at(audio_rate_t rate, audio_bits_t bits, uint32_t seq) {
+  if (pipeline_format(rate, bits) != 0) return -1;
+
+  atomic_store_explicit(&switch_seq, seq, memory_order_relaxed);
+  atomic_store_explicit(&switch_armed, 1, memory_order_release);
+  LOGD("pipeline switch to %d/%d at seq %u", rate_name(rate), bits_name(bits), seq);
+
+  return 0;
+}
+
+void pipeline_sequence(int valid, uint32_t seq) {
+  packet_seq_valid = valid;
+  packet_seq = seq;
+}
+
+static void pipeline_fir_swap(float **taps, size_t *len, uint32_t *rate) {
+  float *t;
+  size_t l;
+  uint32_t r;
+
+  pthread_mutex_lock(&fir_mutex);
+  t = fir_taps;
+  l = fir_len;
+  r = fir_rate;
+  fir_taps = *taps;
+  fir_len = *len;
+  fir_rate = *rate;
+  atomic_fetch_add(&fir_gen, 1);
+  pthread_mutex_unlock(&fir_mutex);
+
+  *taps = t;
+  *len = l;
+  *rate = r;
+}
+
+/**
+ * 滤波器的采样率来自文件中的 rate 注释，没有时使用 -r 指定的输出采样率。
+ * 正在播放时在调用者的线程中按当前格式重建，失败时恢复原来的滤波器，
+ * 新的 pipeline 交给音频路径在下一个数据包时切换。pending 中已有为格式切换准备的
+ * pipeline 时不替换它，由切换后的重建请求换上新的滤波器
+ */
+int pipeline_load_fir(const char *path) {
+  float *taps = NULL;
+  size_t len = 0;
+  uint32_t rate = 0, format = atomic_load(&active_format), out_hz;
+  pipeline_t *p;
+
+  if (path) {
+    taps = fir_load_file(path, &len, &rate);
+    if (taps == NULL) return -1;
+    if (rate == 0) rate = pl_cfg.out_rate;
+    out_hz = pl_cfg.out_rate ? pl_cfg.out_rate : format ? pipeline_out_hz(format >> 8) : rate;
+    if (rate == 0) {
+      LOGE("fir %s has no '# rate <hz>' line and the output rate is not fixed", path);
+      free(taps);
+      return -1;
+    }
+    if (rate != out_hz) {
+      LOGE("fir %s is %u Hz, output is %u Hz", path, rate, out_hz);
+      free(taps);
+      return -1;
+    }
+  }
+
+  pipeline_fir_swap(&taps, &len, &rate);
+
+  if (format && pl_running) {
+    p = pipeline_create(format >> 8, format & 0xFF);
+    if (p == NULL || (path && p->convolver == NULL)) {
+      LOGE("fir %s rebuild failed", path ? path : "off");
+      pipeline_destroy(p);
+      pipeline_fir_swap(&taps, &len, &rate);
+      free(taps);
+      return -1;
+    }
+    pipeline_stage_fir(p);
+  }
+  free(taps);
+
+  LOGI("fir %s", path ? path : "off");
+
+  return 0;
+}
+
+uint32_t pipeline_fir_taps() {
+  uint32_t len;
+
+  pthread_mutex_lock(&fir_mutex);
+  len = fir_len;
+  pthread_mutex_unlock(&fir_mutex);
+
+  return len;
+}
+
+/**
+ * 格式不变而滤波器更换时，等新的 pipeline 准备好后再交换，期间继续使用旧的滤波器
+ */
+static pipeline_t *pipeline_refresh(pipeline_t *p) {
+  pipeline_t *staged = atomic_exchange(&pending, NULL), *expected = NULL;
+
+  if (staged == NULL) return p;
+
+  if (p->rate != staged->rate || p->sample_bits != staged->sample_bits) {
+    // 为即将到来的格式准备的，放回去
+    if (!atomic_compare_exchange_strong(&pending, &expected, staged)) pipeline_retire(staged);
+    return p;
+  }
+
+  // 准备期间滤波器又换了，按最新的重新准备
+  if (staged->fir_gen != atomic_load(&fir_gen)) {
+    pipeline_retire(staged);
+    pipeline_request_fir();
+    return p;
+  }
+
+  pipeline_retire(p);
+  active = staged;
+  LOGD("pipeline fir swapped");
+  return staged;
+}
+
+static pipeline_t *pipeline_switch(const header_sample_t *sample) {
+  pipeline_t *p = atomic_exchange(&pending, NULL);
+
+  if (!pipeline_match(p, sample)) {
+    if (p) pipeline_retire(p);
+    LOGW("unstaged format switch to %d/%d", rate_name(sample->rate), bits_name(sample->bits));
+    p = pipeline_create(sample->rate, sample->bits);
+    if (p == NULL) p = pipeline_reject(sample);
+    if (p == NULL) return NULL;
+  }
+
+  pipeline_retire(active);
+  active = p;
+  atomic_store(&active_format, p->rejected ? 0 : (uint32_t) p->rate << 8 | p->sample_bits);
+  if (p->rejected) return p;
+
+  // 提前准备的 pipeline 使用的是旧的滤波器
+  if (p->fir_gen != atomic_load(&fir_gen)) pipeline_request_fir();
+  recorder_event(REC_FORMAT, (uint32_t) rate_name(sample->rate) << 8 | bits_name(sample->bits));
+
+  if (pl_cfg.format_cb) pl_cfg.format_cb(p->out_rate, p->sample_bits);
+
+  return p;
+}
+
+/**
+ * 按序号判断当前包在切换点之前还是之后
+ * @return 1 表示切换之前的迟到包，格式与当前 pipeline 不符，丢弃
+ */
+static int pipeline_boundary(const header_sample_t *sample) {
+  uint32_t at;
+
+  if (!packet_seq_valid) return 0;
+
+  if (atomic_load_explicit(&switch_armed, memory_order_acquire)) {
+    at = atomic_load_explicit(&switch_seq, memory_order_relaxed);
+    if ((int32_t) (packet_seq - at) < 0) return 0;
+
+    atomic_store_explicit(&switch_armed, 0, memory_order_relaxed);
+    switched_seq = at;
+    switched = 1;
+    if (pipeline_match(active, sample)) LOGW("format unchanged at switch seq %u", at);
+    return 0;
+  }
+
+  return switched && !pipeline_match(active, sample) && (int32_t) (packet_seq - switched_seq) < 0 &&
+         switched_seq - packet_seq <= PIPELINE_LATE_WINDOW;
+}
+
+static void pipeline_standby(int enter) {
+  if (standby == enter) return;
+  standby = enter;
+
+  LOGI("output %s", enter ? "standby" : "resume");
+  recorder_event(REC_STANDBY, enter);
+  if (pl_cfg.suspend_cb) pl_cfg.suspend_cb(enter);
+  speaker_amp_standby(enter);
+}
+
+/**
+ * 统计连续静音的时长，超过 standby_after 秒后进入待机
+ * @return 1 表示已待机，数据包直接丢弃
+ */
+static int pipeline_silent(uint32_t rate, size_t frames) {
+  silent_packets++;
+  if (rate) silent_usec += (uint64_t) frames * 1000000 / rate;
+
+  if (pl_cfg.standby_after && silent_usec >= (uint64_t) pl_cfg.standby_after * 1000000) pipeline_standby(1);
+
+  return standby;
+}
+
+static void pipeline_publish(uint32_t rate) {
+  if (meter.frames < rate / METER_PUBLISH_HZ) return;
+
+  pthread_mutex_lock(&levels_mutex);
+  meter_read(&meter, &levels);
+  pthread_mutex_unlock(&levels_mutex);
+}
+
+void pipeline_levels(struct meter_levels *out) {
+  pthread_mutex_lock(&levels_mutex);
+  *out = levels;
+  pthread_mutex_unlock(&levels_mutex);
+}
+
+/**
+ * 一个声道从解码、重采样、滤波到编码的整条处理，在工作线程中执行。
+ * 各声道只读写自己的缓冲区、历史和交错 PCM 中自己的采样，重采样的相位由调用者统一推进
+ */
+static void pipeline_channel(void *arg, uint32_t ch) {
+  struct pipeline_job *j = arg;
+  pipeline_t *p = j->p;
+  float *buf = p->in[ch];
+  size_t n = j->frames;
+
+  pcm_channel_to_float(buf, j->data, n, pl_cfg.channels, ch, p->bits);
+  if (j->meter) meter_block(&meter, ch, buf, n);
+  if (p->resampler) {
+    n = resampler_process_channel(p->resampler, ch, p->out[ch], buf, n);
+    buf = p->out[ch];
+  }
+  if (p->convolver) convolver_process_channel(p->convolver, ch, buf, n);
+  float_to_pcm_channel(p->pcm, buf, n, pl_cfg.channels, ch, p->bits);
+}
+
+void pipeline_flush() {
+  pipeline_t *p = active;
+
+  if (p == NULL) return;
+
+  if (p->resampler) resampler_reset(p->resampler);
+  if (p->convolver) {
+    convolver_reset(p->convolver);
+    p->fir_idle = 1;
+  }
+}
+
+int pipeline_send(pcm_header_t *header, const uint8_t *data) {
+  pcm_header_t out_header;
+  pipeline_t *p = active;
+  uint32_t rate, frame_size;
+  size_t frames, n;
+  int silent;
+
+  if (pipeline_boundary(&header->sample)) {
+    LOGD("pipeline drop seq %u before switch %u", packet_seq, switched_seq);
+    return 0;
+  }
+
+  if (!pipeline_match(p, &header->sample)) {
+    p = pipeline_switch(&header->sample);
+    if (p == NULL) return -1;
+  } else if (p->fir_gen != atomic_load_explicit(&fir_gen, memory_order_relaxed)) {
+    p = pipeline_refresh(p);
+  }
+  if (p->rejected) return -1;
+
+  rate = rate_name(header->sample.rate);
+  frame_size = pl_cfg.channels * (p->bits / 8);
+  if (frame_size == 0) return pl_cfg.output_cb(header, data);
+  frames = header->len / frame_size;
+
+  silent = pcm_is_silent(data, header->len);
+  if (silent) {
+    meter.frames += frames;
+    pipeline_publish(rate);
+    if (pipeline_silent(rate, frames)) return 0;
+  } else if (silent_packets) {
+    silent_packets = 0;
+    silent_usec = 0;
+    pipeline_standby(0);
+  }
+
+  if (p->resampler == NULL && p->convolver == NULL) {
+    if (!silent) {
+      pcm_meter(data, frames, pl_cfg.channels, p->bits, &meter);
+      pipeline_publish(rate);
+    }
+    return pl_cfg.output_cb(header, data);
+  }
+
+  if (frames > p->max_frames) frames = p->max_frames;
+
+  // 第一个静音包仍然完整处理，让滤波器的尾音输出
+  if (silent && silent_packets > 1 && silent_usec > p->tail_usec) {
+    n = p->resampler ? resampler_skip(p->resampler, frames) : frames;
+    if (p->convolver && !p->fir_idle) {
+      convolver_reset(p->convolver);
+      p->fir_idle = 1;
+    }
+    memset(p->pcm, 0, n * frame_size);
+  } else {
+    job.p = p;
+    job.data = data;
+    job.frames = frames;
+    job.meter = !silent;
+    workers_run(pipeline_channel, &job, pl_cfg.channels);
+
+    n = p->resampler ? resampler_advance(p->resampler, frames) : frames;
+    if (p->convolver) p->fir_idle = 0;
+    if (!silent) {
+      meter.frames += frames;
+      pipeline_publish(rate);
+    }
+  }
+  if (n == 0) return 0;
+
+  out_header = *header;
+  out_header.sample.rate = p->out_rate;
+  out_header.len = n * frame_size;
+
+  return pl_cfg.output_cb(&out_header, p->pcm);
+}
@@ -0,0 +1,85 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_PIPELINE_H
+#define SPEAKER_PIPELINE_H
+
+#include "speaker.h"
+#include "speaker_receiver.h"
+#include "dsp/meter.h"
+
+#define PIPELINE_MAX_CHANNELS METER_MAX_CHANNELS
+#define METER_PUBLISH_HZ 10
+
+struct pipeline_config {
+    output_send_fn output_cb;
+    set_audio_format_fn format_cb;
+    uint32_t out_rate;
+    uint32_t channels;
+    uint32_t mtu;
+    uint32_t standby_after;
+    output_suspend_fn suspend_cb;
+    /* 声道处理的工作线程数，0 为自动，WORKERS_INLINE 为不使用 */
+    uint32_t workers;
+};
+
+int pipeline_init(const struct pipeline_config *cfg);
+
+void pipeline_deinit();
+
+int pipeline_send(pcm_header_t *header, const uint8_t *data);
+
+int pipeline_format(audio_rate_t rate, audio_bits_t bits);
+
+/**
+ * 格式在序号 seq 的数据包处切换，新的 pipeline 在此之前于后台准备好
+ */
+int pipeline_format_at(audio_rate_t rate, audio_bits_t bits, uint32_t seq);
+
+/**
+ * 接收端在每个数据包送入 pipeline_send 之前调用
+ */
+void pipeline_sequence(int valid, uint32_t seq);
+
+/**
+ * 跳转时清空重采样器和滤波器中旧位置的样本，在音频路径上调用
+ */
+void pipeline_flush();
+
+audio_rate_t rate_from_hz(uint32_t hz);
+
+/**
+ * 加载房间校正滤波器，path 为 NULL 时关闭。滤波器在后台线程中按当前格式重建，
+ * 准备好后在音频路径上切换
+ */
+int pipeline_load_fir(const char *path);
+
+uint32_t pipeline_fir_taps();
+
+/**
+ * 最近一次发布的电平，每秒更新 METER_PUBLISH_HZ 次
+ */
+void pipeline_levels(struct meter_levels *out);
+
+/**
+ * 功放待机，嵌入式平台覆盖这个弱符号以控制功放芯片
+ */
+void speaker_amp_standby(int standby);
+
+#endif
@@ -0,0 +1,192 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "speaker_pool.h"
+
+/*
+ * 空闲链表头为 版本号 + 下标，版本号防止 ABA。32 位平台（ESP32）没有无锁的 64 位 CAS，
+ * 链表头压缩为 16 位版本号 + 16 位下标
+ */
+#if defined(ESP_PLATFORM) || ATOMIC_LLONG_LOCK_FREE != 2
+#define POOL_HEAD_BITS 16
+typedef uint32_t pool_head_t;
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "pool needs a lock-free 32-bit CAS");
+#else
+#define POOL_HEAD_BITS 32
+typedef uint64_t pool_head_t;
+#endif
+
+#define POOL_NIL ((uint32_t) (((pool_head_t) 1 << POOL_HEAD_BITS) - 1))
+#define POOL_MAX_DEPTH POOL_NIL
+#define POOL_HEAD_INDEX(h) ((uint32_t) ((h) & POOL_NIL))
+#define POOL_HEAD_NEXT(h, index) ((((h) >> POOL_HEAD_BITS) + 1) << POOL_HEAD_BITS | (pool_head_t) (index))
+#define POOL_ALIGN(n) (((n) + POOL_CACHE_LINE - 1) & ~(size_t) (POOL_CACHE_LINE - 1))
+#define POOL_STRIDE(mtu) POOL_ALIGN(sizeof(pool_slot_t) + (mtu))
+
+#ifdef ESP_PLATFORM
+_Static_assert(POOL_STATIC_DEPTH < POOL_MAX_DEPTH, "POOL_STATIC_DEPTH too large for the pool head");
+static uint8_t pool_storage[POOL_STATIC_DEPTH * POOL_STRIDE(POOL_STATIC_MTU)]
+  __attribute__((aligned(POOL_CACHE_LINE)));
+#endif
+
+static uint8_t *pool_base = NULL;
+static size_t pool_stride = 0;
+static uint32_t pool_depth = 0;
+
+static _Atomic pool_head_t pool_free = POOL_NIL;
+static atomic_uint pool_in_use = 0;
+static atomic_uint pool_high_water = 0;
+static atomic_uint pool_exhausted = 0;
+
+LOG_TAG_DECLR("pool");
+
+static inline pool_slot_t *pool_slot(uint32_t index) {
+  return (pool_slot_t *) (pool_base + index * pool_stride);
+}
+
+static inline uint32_t pool_index(const pool_slot_t *slot) {
+  return (uint32_t) (((const uint8_t *) slot - pool_base) / pool_stride);
+}
+
+static void pool_push(pool_slot_t *slot) {
+  pool_head_t head = atomic_load_explicit(&pool_free, memory_order_relaxed), next;
+  uint32_t index = pool_index(slot);
+
+  do {
+    atomic_store_explicit(&slot->next, POOL_HEAD_INDEX(head), memory_order_relaxed);
+    next = POOL_HEAD_NEXT(head, index);
+  } while (!atomic_compare_exchange_weak_explicit(&pool_free, &head, next, memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+static pool_slot_t *pool_pop() {
+  pool_head_t head = atomic_load_explicit(&pool_free, memory_order_acquire), next;
+  pool_slot_t *slot;
+
+  do {
+    if (POOL_HEAD_INDEX(head) == POOL_NIL) return NULL;
+    slot = pool_slot(POOL_HEAD_INDEX(head));
+    next = POOL_HEAD_NEXT(head, atomic_load_explicit(&slot->next, memory_order_relaxed));
+  } while (!atomic_compare_exchange_weak_explicit(&pool_free, &head, next, memory_order_acquire,
+                                                  memory_order_acquire));
+
+  return slot;
+}
+
+int pool_init(const struct pool_config *cfg) {
+  uint32_t mtu, i;
+
+  LOGT("pool init");
+
+  if (cfg == NULL || cfg->mtu == 0) {
+    LOGE("pool mtu can not empty");
+    return -1;
+  }
+
+#ifdef ESP_PLATFORM
+  if (cfg->mtu > POOL_STATIC_MTU || cfg->depth > POOL_STATIC_DEPTH) {
+    LOGE("pool %u x %u exceeds static storage %u x %u", cfg->depth, cfg->mtu, POOL_STATIC_DEPTH, POOL_STATIC_MTU);
+    return -1;
+  }
+  mtu = POOL_STATIC_MTU;
+  pool_depth = cfg->depth ? cfg->depth : POOL_STATIC_DEPTH;
+  pool_base = pool_storage;
+#else
+  mtu = cfg->mtu;
+  pool_depth = cfg->depth ? cfg->depth : BUFFER_LIST_SIZE;
+  if (pool_depth >= POOL_MAX_DEPTH) {
+    LOGE("pool depth %u exceeds %u", pool_depth, POOL_MAX_DEPTH - 1);
+    return -1;
+  }
+  pool_base = aligned_alloc(POOL_CACHE_LINE, pool_depth * POOL_STRIDE(mtu));
+  if (pool_base == NULL) {
+    LOGE("pool alloc %u x %u failed", pool_depth, mtu);
+    return -1;
+  }
+#endif
+  pool_stride = POOL_STRIDE(mtu);
+
+  atomic_store(&pool_free, POOL_NIL);
+  atomic_store(&pool_in_use, 0);
+  atomic_store(&pool_high_water, 0);
+  atomic_store(&pool_exhausted, 0);
+
+  for (i = pool_depth; i > 0; i--) {
+    atomic_store(&pool_slot(i - 1)->refs, 0);
+    pool_push(pool_slot(i - 1));
+  }
+
+  LOGI("pool %u slots, %u bytes each", pool_depth, (uint32_t) pool_stride);
+  return 0;
+}
+
+void pool_deinit() {
+  LOGT("pool deinit");
+
+  if (pool_base == NULL) return;
+
+  LOGI("pool high water %u/%u, exhausted %u", atomic_load(&pool_high_water), pool_depth,
+       atomic_load(&pool_exhausted));
+
+#ifndef ESP_PLATFORM
+  free(pool_base);
+#endif
+  pool_base = NULL;
+  pool_depth = 0;
+  atomic_store(&pool_free, POOL_NIL);
+}
+
+pool_slot_t *pool_acquire() {
+  pool_slot_t *slot = pool_pop();
+  unsigned used, hw;
+
+  if (slot == NULL) {
+    atomic_fetch_add_explicit(&pool_exhausted, 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  atomic_store_explicit(&slot->refs, 1, memory_order_relaxed);
+  slot->len = 0;
+
+  used = atomic_fetch_add_explicit(&pool_in_use, 1, memory_order_relaxed) + 1;
+  hw = atomic_load_explicit(&pool_high_water, memory_order_relaxed);
+  while (used > hw &&
+         !atomic_compare_exchange_weak_explicit(&pool_high_water, &hw, used, memory_order_relaxed,
+                                                memory_order_relaxed));
+
+  return slot;
+}
+
+void pool_ref(pool_slot_t *slot) {
+  atomic_fetch_add_explicit(&slot->refs, 1, memory_order_relaxed);
+}
+
+void pool_release(pool_slot_t *slot) {
+  if (atomic_fetch_sub_explicit(&slot->refs, 1, memory_order_acq_rel) != 1) return;
+
+  atomic_fetch_sub_explicit(&pool_in_use, 1, memory_order_relaxed);
+  pool_push(slot);
+}
+
+void pool_get_stats(struct pool_stats *stats) {
+  stats->depth = pool_depth;
+  stats->in_use = atomic_load_explicit(&pool_in_use, memory_order_relaxed);
+  stats->high_water = atomic_load_explicit(&pool_high_water, memory_order_relaxed);
+  stats->exhausted = atomic_load_explicit(&pool_exhausted, memory_order_relaxed);
+}
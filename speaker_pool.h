@@ -0,0 +1,74 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_POOL_H
+#define SPEAKER_POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "speaker.h"
+
+#define POOL_CACHE_LINE 64
+
+#ifndef POOL_STATIC_MTU
+#define POOL_STATIC_MTU 1500
+#endif
+
+#ifndef POOL_STATIC_DEPTH
+#define POOL_STATIC_DEPTH BUFFER_LIST_SIZE
+#endif
+
+typedef struct pool_slot {
+    atomic_uint refs;
+    atomic_uint next;
+    uint32_t len;
+    pcm_header_t header;
+    uint8_t data[] __attribute__((aligned(16)));
+} pool_slot_t;
+
+struct pool_config {
+    uint32_t mtu;
+    uint32_t depth;
+};
+
+struct pool_stats {
+    uint32_t depth;
+    uint32_t in_use;
+    uint32_t high_water;
+    uint32_t exhausted;
+};
+
+/**
+ * 输出端需要保留数据时，通过 header 找到所在的槽位并调用 pool_ref
+ */
+#define POOL_SLOT_OF(hdr) ((pool_slot_t *) ((uint8_t *) (hdr) - offsetof(pool_slot_t, header)))
+
+int pool_init(const struct pool_config *cfg);
+
+void pool_deinit();
+
+pool_slot_t *pool_acquire();
+
+void pool_ref(pool_slot_t *slot);
+
+void pool_release(pool_slot_t *slot);
+
+void pool_get_stats(struct pool_stats *stats);
+
+#endif
@@ -16,9 +16,12 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
 
+#include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <common/connection.h>
 #include <common/event/select.h>
 #include <common/package/control.h>
@@ -28,22 +31,73 @@
 
 #include "speaker_receiver.h"
 #include "speaker_multicast.h"
+#include "speaker_pool.h"
+#include "speaker_schedule.h"
+#include "speaker_pcm.h"
+#include "speaker_recorder.h"
 
 static uint16_t data_port = DEFAULT_RECEIVER_PORT;
 static addr_t listen_ip = {AF_INET};
 static output_send_fn output_fn = NULL;
 static set_audio_format_fn format_fn = NULL;
+static set_audio_format_at_fn format_at_fn = NULL;
+static output_sequence_fn sequence_fn = NULL;
+static output_latency_fn latency_fn = NULL;
+static forward_fn forward_cb = NULL;
+static struct socket_tune tune = {.dscp = -1, .priority = -1};
+static addr_t data_group = {0};
+#ifdef ESP_PLATFORM
+static uint32_t data_mtu = POOL_STATIC_MTU;
+#else
+static uint32_t data_mtu = PACKAGE_MAX_SIZE;
+#endif
 
 static uint32_t ctrl_sample_chunk;
 static audio_rate_t ctrl_sample_rate;
 static audio_bits_t ctrl_sample_bits;
-static pcm_header_t pcm_header = {0};
 
 static connection_t conn = DEFAULT_CONNECTION_UDP_INIT;
 
+/* 数据端口由接收线程直接读到缓冲池的槽位中，不经过事件层的缓冲区 */
+static pthread_t rx_thread;
+static atomic_int rx_running = 0;
+
+/* AF_XDP 只接管绑定的队列，其它队列的数据仍然走 socket，两条路径同时存在时需要加锁 */
+static int rx_shared = 0;
+static pthread_mutex_t rx_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* v2 包的序号和媒体时间，用来发现丢包和乱序 */
+static pcm_seq_t rx_seq = {0};
+static uint32_t rx_channels = 1;
+static uint8_t rx_group = PCM_V2_GROUP_ANY;
+static uint8_t *conceal_buf = NULL;
+
+/*
+ * 通告了 v2 时，服务端以带 START 标志的 v2 包开始一个流，之后的数据包都按 v2 解析，
+ * 连续收到 RECEIVER_V1_FALLBACK 个不是 v2 的包时退回 v1
+ */
+static uint8_t rx_advertised = PCM_WIRE_VERSION;
+static atomic_int rx_version = 1;
+static uint32_t rx_non_v2 = 0;
+
+/* 状态线程读取，字段单独原子更新 */
+static struct {
+    atomic_uint v1_packets;
+    atomic_uint v2_packets;
+    atomic_uint lost;
+    atomic_uint late;
+    atomic_uint resyncs;
+    atomic_uint concealed_frames;
+} rx_stats;
+
+#define RX_STAT_ADD(field, n) atomic_fetch_add_explicit(&rx_stats.field, (n), memory_order_relaxed)
+
 LOG_TAG_DECLR("speaker");
 
-void command(socket_t fd, const void *hd) {
+/**
+ * @param v2 v2 封装的控制包的包头，v1 控制包为 NULL
+ */
+void command(socket_t fd, const void *hd, const pcm_header_v2_t *v2) {
   control_package_t ctl;
   CONTROL_PACKAGE_DECODE(&ctl, hd);
 
@@ -59,7 +113,9 @@ void command(socket_t fd, const void *hd) {
       LOGI("command: sample, %d/%d/%s", rate_name(ctrl_sample_rate), bits_name(ctrl_sample_bits),
            channel_name(ctl.sample.channel));
 
-      if (NULL != format_fn) format_fn(ctrl_sample_rate, ctrl_sample_bits);
+      // v2 的控制包带有生效的序号，pipeline 在该序号处切换
+      if (v2 && NULL != format_at_fn) format_at_fn(ctrl_sample_rate, ctrl_sample_bits, v2->seq);
+      else if (NULL != format_fn) format_fn(ctrl_sample_rate, ctrl_sample_bits);
 
       break;
     case SPCMD_UNKNOWN_SP:
@@ -75,8 +131,35 @@ void pcm_receive() {
 
 }
 
+static void join_data_group(socket_t sockfd) {
+  struct ipv6_mreq imreq = {0};
+  socklen_t sock_len;
+  int optlevel, optname;
+
+  if (data_group.type == AF_INET) {
+    ((struct ip_mreq *) &imreq)->imr_interface = listen_ip.ipv4;
+    ((struct ip_mreq *) &imreq)->imr_multiaddr = data_group.ipv4;
+    sock_len = sizeof(struct ip_mreq);
+    optlevel = IPPROTO_IP;
+    optname = IP_ADD_MEMBERSHIP;
+  } else {
+    imreq.ipv6mr_multiaddr = data_group.ipv6;
+    sock_len = sizeof(struct ipv6_mreq);
+    optlevel = IPPROTO_IPV6;
+    optname = IPV6_ADD_MEMBERSHIP;
+  }
+  if ((setsockopt(sockfd, optlevel, optname, (const void *) &imreq, sock_len)) < 0) {
+    LOGF("Failed add to data group: %m");
+    closesocket(sockfd);
+    sexit(EERR_SOCKET);
+  }
+
+  LOGI("Join data group %s", addr_ntop(&data_group));
+}
+
 socket_t create_receiver_socket() {
   struct sockaddr_storage group_addr = {0};
+  addr_t bind_ip = listen_ip;
 
   socket_t sockfd = socket(listen_ip.type, SOCK_DGRAM, IPPROTO_UDP);
   if (sockfd < 0) {
@@ -84,9 +167,12 @@ socket_t create_receiver_socket() {
     sexit(EERR_SOCKET);
   }
 
-  set_sockaddr(&group_addr, &listen_ip, data_port);
+  // 绑定到单播地址时收不到组播数据
+  if (data_group.type) memset(&bind_ip.ipv6, 0, sizeof(struct in6_addr));
 
-  LOGI("Listen on %s", addr_ntop(&listen_ip));
+  set_sockaddr(&group_addr, &bind_ip, data_port);
+
+  LOGI("Listen on %s", addr_ntop(&bind_ip));
 
   if ((bind(sockfd, (struct sockaddr *) &group_addr, sizeof(group_addr))) < 0) {
     LOGF("detect bind error: %m");
@@ -94,52 +180,324 @@ socket_t create_receiver_socket() {
     sexit(EERR_SOCKET);
   }
 
+  if (data_group.type) join_data_group(sockfd);
+
+  socket_tune(sockfd, listen_ip.type, &tune);
+
+  struct timeval timeout = {
+    .tv_sec = RECEIVER_RECV_TIMEOUT_MSEC / 1000,
+    .tv_usec = RECEIVER_RECV_TIMEOUT_MSEC % 1000 * 1000,
+  };
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) LOGW("receiver timeout: %m");
+
   return sockfd;
 }
 
-int sp_receiver_read(connection_t *c, const struct sockaddr_storage *src, socklen_t src_len, const void *package,
-                     uint32_t len) {
-  uint8_t *samples = (uint8_t *) package + PCM_HEADER_SIZE;
+/**
+ * @return 需要补的静音帧数，-1 表示迟到的包，直接丢弃
+ */
+static int64_t receiver_sequence(const pcm_header_v2_t *v2, uint32_t frames) {
+  uint32_t count;
+  int64_t lost_frames;
+
+  switch (pcm_seq_next(&rx_seq, v2->seq, v2->ts, frames, v2->flags & PCM_V2_FLAG_START, &count, &lost_frames)) {
+    case PCM_SEQ_LATE:
+      RX_STAT_ADD(late, 1);
+      recorder_event(REC_LATE, count);
+      return -1;
+    case PCM_SEQ_GAP:
+      RX_STAT_ADD(lost, count);
+      recorder_event(REC_GAP, count);
+      LOGD("receiver lost %u packets, %lld frames", count, (long long) lost_frames);
+      return lost_frames;
+    case PCM_SEQ_RESYNC:
+      RX_STAT_ADD(resyncs, 1);
+      LOGI("receiver resync at seq %u", v2->seq);
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * 按协商的版本判断数据包的格式，调度包不经过这里
+ * @return 1 为 v2，0 为 v1，-1 为 v2 流中的无效包
+ */
+static int receiver_wire_check(const uint8_t *package, uint32_t len) {
+  int v2 = IS_PCM_V2_PACKAGE(package, len);
+
+  if (rx_advertised < 2) return 0;
+
+  if (atomic_load_explicit(&rx_version, memory_order_relaxed) < 2) {
+    if (!v2 || !(package[offsetof(pcm_header_v2_t, flags)] & PCM_V2_FLAG_START)) return 0;
+    LOGI("receiver stream is v2");
+    atomic_store_explicit(&rx_version, 2, memory_order_relaxed);
+    rx_non_v2 = 0;
+    return 1;
+  }
 
-  if (len == CONTROL_PACKAGE_SIZE) {
-    command(c->read_fd, package);
+  if (v2) {
+    rx_non_v2 = 0;
+    return 1;
+  }
+  if (++rx_non_v2 < RECEIVER_V1_FALLBACK) return -1;
+
+  LOGW("receiver %u packets without v2 header, fall back to v1", rx_non_v2);
+  atomic_store_explicit(&rx_version, 1, memory_order_relaxed);
+  rx_seq.valid = 0;
+  return 0;
+}
+
+int receiver_wire_version() {
+  return atomic_load_explicit(&rx_version, memory_order_relaxed);
+}
+
+/**
+ * 用静音补上丢失的帧，保持和其它扬声器的时间线一致
+ */
+static void receiver_conceal(const pcm_header_t *header, int64_t frames) {
+  uint32_t frame_size = rx_channels * (bits_name(header->sample.bits) / 8);
+  pcm_header_t h = *header;
+
+  if (frames <= 0 || frame_size == 0 || conceal_buf == NULL || output_fn == NULL) return;
+  if ((uint64_t) frames * 1000000 > (uint64_t) rate_name(header->sample.rate) * RECEIVER_MAX_CONCEAL_USEC) return;
+
+  RX_STAT_ADD(concealed_frames, frames);
+  // 与真实的数据包一样，一块不超过包的负载
+  while ((h.len = pcm_conceal_bytes(frames, frame_size, data_mtu - PCM_V2_HEADER_SIZE)) > 0) {
+    output_fn(&h, conceal_buf);
+    frames -= h.len / frame_size;
+  }
+}
+
+/**
+ * @param pcm_header 解码后的包头写在这里，socket 收到的包为所在槽位的 header
+ */
+static int receiver_dispatch(const struct sockaddr_storage *src, socklen_t src_len, const uint8_t *package,
+                             uint32_t len, pcm_header_t *pcm_header) {
+  pcm_header_v2_t v2 = {0};
+  const uint8_t *data = package;
+  uint32_t header_size = PCM_HEADER_SIZE;
+  int64_t conceal;
+  int ret, wire;
+
+  // 调度包有自己的标识，不参与版本判断
+  wire = IS_SCHEDULE_PACKAGE(package, len) ? 0 : receiver_wire_check(package, len);
+
+  if (forward_cb) forward_cb(package, len);
+
+  if (IS_SCHEDULE_PACKAGE(package, len)) {
+    schedule_command(package, len);
     return 0;
   }
 
-  PCM_HEADER_DECODE(&pcm_header, package);
+  if (wire < 0) {
+    LOGD("receiver drop %d bytes without v2 header", len);
+    return -1;
+  }
+
+  if (wire) {
+    pcm_v2_decode(&v2, package);
+    if (v2.group != PCM_V2_GROUP_ANY && rx_group != PCM_V2_GROUP_ANY && v2.group != rx_group) return 0;
+    if (v2.flags & PCM_V2_FLAG_CONTROL) {
+      if (len - PCM_V2_HEADER_SIZE == CONTROL_PACKAGE_SIZE) command(conn.read_fd, package + PCM_V2_HEADER_SIZE, &v2);
+      return 0;
+    }
+    header_size = PCM_V2_HEADER_SIZE;
+  } else if (len == CONTROL_PACKAGE_SIZE) {
+    command(conn.read_fd, package, NULL);
+    return 0;
+  }
 
-  if (len - PCM_HEADER_SIZE != pcm_header.len) {
-    LOGD("receiver recvfrom fail: %d(need %d)", len, pcm_header.len);
+  if (len > data_mtu) {
+    LOGD("receiver package too large: %d(mtu %d)", len, data_mtu);
     return -1;
   }
 
-  LOGT("rate: %08d, bit: %03d, len: %05d", rate_name(pcm_header.sample.rate), bits_name(pcm_header.sample.bits),
-       pcm_header.len);
+  if (v2.magic) {
+    pcm_header->len = v2.len;
+    pcm_header->sample.rate = v2.rate;
+    pcm_header->sample.bits = v2.bits;
+    pcm_header->sample.channel = v2.channel;
+  } else {
+    PCM_HEADER_DECODE(pcm_header, data);
+  }
 
-  if (output_fn && output_fn(&pcm_header, samples) != 0)
+  if (len - header_size != pcm_header->len) {
+    LOGD("receiver recvfrom fail: %d(need %d)", len, pcm_header->len);
+    return -1;
+  }
+
+  recorder_packet(v2.magic ? 2 : 1, pcm_header, v2.seq, v2.ts, latency_fn ? latency_fn() : 0,
+                  src->ss_family == AF_INET ? ((const struct sockaddr_in *) src)->sin_addr.s_addr : 0);
+
+  if (v2.magic) {
+    RX_STAT_ADD(v2_packets, 1);
+    conceal = receiver_sequence(&v2, bits_name(v2.bits) ? pcm_header->len / (rx_channels * (bits_name(v2.bits) / 8))
+                                                        : 0);
+    if (conceal < 0) return 0;
+    receiver_conceal(pcm_header, conceal);
+  } else {
+    RX_STAT_ADD(v1_packets, 1);
+  }
+
+  // 迟到丢弃的包不能推进 pipeline 的序号，否则会触发一个永远不会播放的格式切换
+  if (sequence_fn) sequence_fn(v2.magic != 0, v2.seq);
+
+  LOGT("rate: %08d, bit: %03d, len: %05d, latency: %uus", rate_name(pcm_header->sample.rate),
+       bits_name(pcm_header->sample.bits), pcm_header->len, latency_fn ? latency_fn() : 0);
+
+  ret = output_fn ? output_fn(pcm_header, data + header_size) : 0;
+  if (ret != 0)
     return -1;
 
   uint8_t time_sync = 1;
-  sendto(c->read_fd, &time_sync, sizeof(time_sync), 0, (struct sockaddr *) src, src_len);
+  sendto(conn.read_fd, &time_sync, sizeof(time_sync), 0, (struct sockaddr *) src, src_len);
 
   return 0;
 }
 
+static int receiver_handle(const struct sockaddr_storage *src, socklen_t src_len, const uint8_t *package,
+                           uint32_t len, pcm_header_t *pcm_header) {
+  int ret;
+
+  if (!rx_shared) return receiver_dispatch(src, src_len, package, len, pcm_header);
+
+  pthread_mutex_lock(&rx_mutex);
+  ret = receiver_dispatch(src, src_len, package, len, pcm_header);
+  pthread_mutex_unlock(&rx_mutex);
+
+  return ret;
+}
+
+int receiver_package(const struct sockaddr_storage *src, socklen_t src_len, const uint8_t *package, uint32_t len) {
+  pcm_header_t header;
+
+  return receiver_handle(src, src_len, package, len, &header);
+}
+
+/**
+ * 一次读取最多 n 个包，每个包写入一个槽位
+ * @return 收到的包数，没有数据时为 0，-1 表示出错
+ */
+static int receiver_recv(pool_slot_t **slots, int n, struct sockaddr_storage *srcs, socklen_t *src_lens) {
+#ifdef __linux__
+  struct mmsghdr msgs[RECEIVER_BATCH];
+  struct iovec iovs[RECEIVER_BATCH];
+  int i, got;
+
+  for (i = 0; i < n; i++) {
+    iovs[i].iov_base = slots[i]->data;
+    iovs[i].iov_len = data_mtu;
+    msgs[i].msg_hdr = (struct msghdr) {
+      .msg_name = &srcs[i],
+      .msg_namelen = sizeof(srcs[i]),
+      .msg_iov = &iovs[i],
+      .msg_iovlen = 1,
+    };
+  }
+
+  // 阻塞到第一个包，之后只取已经到达的
+  got = recvmmsg(conn.read_fd, msgs, n, MSG_WAITFORONE, NULL);
+  if (got < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+  for (i = 0; i < got; i++) {
+    slots[i]->len = msgs[i].msg_hdr.msg_flags & MSG_TRUNC ? data_mtu + 1 : msgs[i].msg_len;
+    src_lens[i] = msgs[i].msg_hdr.msg_namelen;
+  }
+  return got;
+#else
+  int len;
+
+  src_lens[0] = sizeof(srcs[0]);
+  len = recvfrom(conn.read_fd, slots[0]->data, data_mtu, 0, (struct sockaddr *) &srcs[0], &src_lens[0]);
+  if (len < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+  slots[0]->len = len;
+  return 1;
+#endif
+}
+
+/**
+ * 输出端可以对槽位 pool_ref 以保留数据，这里只释放接收线程自己的引用
+ */
+static void *thread_receiver(void *arg) {
+  pool_slot_t *slots[RECEIVER_BATCH];
+  struct sockaddr_storage srcs[RECEIVER_BATCH];
+  socklen_t src_lens[RECEIVER_BATCH];
+  int i, n, got;
+
+  while (atomic_load_explicit(&rx_running, memory_order_relaxed)) {
+    for (n = 0; n < RECEIVER_BATCH; n++) {
+      slots[n] = pool_acquire();
+      if (slots[n] == NULL) break;
+    }
+    if (n == 0) {
+      LOGD("receiver pool exhausted");
+      usleep(1000);
+      continue;
+    }
+
+    got = receiver_recv(slots, n, srcs, src_lens);
+    if (got < 0 && atomic_load_explicit(&rx_running, memory_order_relaxed)) LOGD("receiver recv error: %m");
+
+    // shutdown 之后读到长度为 0 的包
+    for (i = 0; i < got; i++) {
+      if (slots[i]->len == 0) continue;
+      receiver_handle(&srcs[i], src_lens[i], slots[i]->data, slots[i]->len, &slots[i]->header);
+    }
+    for (i = 0; i < n; i++) pool_release(slots[i]);
+  }
+
+  pthread_exit(NULL);
+}
+
+void receiver_set_shared(int shared) {
+  rx_shared = shared;
+}
+
+void receiver_get_stats(struct receiver_stats *stats) {
+  stats->v1_packets = atomic_load_explicit(&rx_stats.v1_packets, memory_order_relaxed);
+  stats->v2_packets = atomic_load_explicit(&rx_stats.v2_packets, memory_order_relaxed);
+  stats->lost = atomic_load_explicit(&rx_stats.lost, memory_order_relaxed);
+  stats->late = atomic_load_explicit(&rx_stats.late, memory_order_relaxed);
+  stats->resyncs = atomic_load_explicit(&rx_stats.resyncs, memory_order_relaxed);
+  stats->concealed_frames = atomic_load_explicit(&rx_stats.concealed_frames, memory_order_relaxed);
+}
+
+uint16_t receiver_port() {
+  return data_port;
+}
+
 int receiver_stop() {
   LOGD("exit receiver thread");
-  event_del(&conn);
 
-  shutdown(conn.read_fd, 0);
+  if (atomic_exchange(&rx_running, 0)) {
+    // 唤醒阻塞在读取上的接收线程
+    shutdown(conn.read_fd, SHUT_RD);
+    pthread_join(rx_thread, NULL);
+  }
   closesocket(conn.read_fd);
 
   return 0;
 }
 
+int64_t receiver_drops() {
+  return socket_drops(conn.read_fd, listen_ip.type);
+}
+
 int receiver_start() {
   LOGT("receiver start");
 
   conn.read_fd = create_receiver_socket();
-  event_add(&conn);
+
+  atomic_store(&rx_running, 1);
+  if (0 != pthread_create(&rx_thread, NULL, thread_receiver, NULL)) {
+    LOGF("receiver thread create error: %m");
+    atomic_store(&rx_running, 0);
+    closesocket(conn.read_fd);
+    sexit(EERR_SOCKET);
+  }
 
   return 0;
 }
@@ -153,14 +511,34 @@ int receiver_init(const struct receiver_config *cfg) {
   listen_ip.type = cfg->family;
   if (cfg->output_cb != NULL) output_fn = cfg->output_cb;
   if (cfg->format_cb != NULL) format_fn = cfg->format_cb;
+  format_at_fn = cfg->format_at_cb;
+  sequence_fn = cfg->sequence_cb;
+  if (cfg->latency_cb != NULL) latency_fn = cfg->latency_cb;
   if (cfg->port) data_port = cfg->port;
   if (cfg->ip) listen_ip = *cfg->ip;
   else memset(&listen_ip.ipv6, 0, sizeof(struct in6_addr));
 
   if (!data_port) data_port = DEFAULT_RECEIVER_PORT;
+  if (cfg->mtu) data_mtu = cfg->mtu;
+  if (cfg->group) data_group = *cfg->group;
+  forward_cb = cfg->forward_cb;
+  if (cfg->tune) tune = *cfg->tune;
+  rx_channels = cfg->channels ? cfg->channels : 1;
+  rx_group = cfg->group_id;
+  rx_advertised = cfg->version ? cfg->version : PCM_WIRE_VERSION;
+
+  conceal_buf = calloc(1, data_mtu);
+
+  struct pool_config pool_cfg = {
+    .mtu = data_mtu,
+    .depth = cfg->pool_depth,
+  };
+  if (0 > pool_init(&pool_cfg)) {
+    LOGF("receiver pool init failed");
+    sexit(EERR_ARG);
+  }
 
   conn.family = cfg->family;
-  conn.read_cb = sp_receiver_read;
 
   receiver_start();
 
@@ -171,4 +549,7 @@ void receiver_deinit() {
   LOGT("receiver deinit");
 
   receiver_stop();
+  pool_deinit();
+  free(conceal_buf);
+  conceal_buf = NULL;
 }
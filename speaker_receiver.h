@@ -21,17 +21,85 @@
 #define  SPEAKER_RECEIVER_H
 
 #include "speaker.h"
+#include "speaker_socket.h"
 
+/**
+ * socket 收到的包 header 和 data 都在缓冲池的槽位中，返回后还要使用数据时用 POOL_SLOT_OF(header)
+ * 取得槽位并 pool_ref，用完后 pool_release。AF_XDP 收到的包和补的静音不在缓冲池中，只在调用期间有效
+ */
 typedef int (*output_send_fn)(pcm_header_t *header, const uint8_t *data);
 
 typedef int (*set_audio_format_fn)(audio_rate_t rate, audio_bits_t bits);
 
+/**
+ * 带切换序号的格式命令，seq 为第一个新格式数据包的序号
+ */
+typedef int (*set_audio_format_at_fn)(audio_rate_t rate, audio_bits_t bits, uint32_t seq);
+
+/**
+ * 数据包通过序号检查后、在 output_send_fn 之前调用，给出即将送出的数据包的序号，v1 包 valid 为 0。
+ * 补静音在它之前送出，仍使用上一个包的序号
+ */
+typedef void (*output_sequence_fn)(int valid, uint32_t seq);
+
+typedef uint32_t (*output_latency_fn)();
+
+typedef int (*output_flush_fn)();
+
+/**
+ * 输出缓冲区中还能写入的字节数
+ */
+typedef uint32_t (*output_space_fn)();
+
+/**
+ * 输出缓冲区中还没有交给设备的数据时长，微秒
+ */
+typedef uint32_t (*output_queued_fn)();
+
+typedef int (*output_suspend_fn)(int suspend);
+
+/* 丢包超过这个时长时不再补静音，由下游按格式切换或欠载处理 */
+#define RECEIVER_MAX_CONCEAL_USEC 100000
+/* v2 流中连续这么多个不是 v2 的包，认为服务端换成了 v1 */
+#define RECEIVER_V1_FALLBACK 16
+/* 接收线程一次最多读取的包数，每个包占用一个缓冲池槽位 */
+#ifdef __linux__
+#define RECEIVER_BATCH 8
+#else
+#define RECEIVER_BATCH 1
+#endif
+/* 阻塞读取的超时，平台的 shutdown 不能唤醒读取时靠它退出接收线程 */
+#define RECEIVER_RECV_TIMEOUT_MSEC 200
+
+struct receiver_stats {
+    uint32_t v1_packets;
+    uint32_t v2_packets;
+    uint32_t lost;
+    uint32_t late;
+    uint32_t resyncs;
+    uint32_t concealed_frames;
+};
+
 struct receiver_config {
     sa_family_t family;
     addr_t *ip;
     uint16_t port;
     output_send_fn output_cb;
     set_audio_format_fn format_cb;
+    set_audio_format_at_fn format_at_cb;
+    output_sequence_fn sequence_cb;
+    output_latency_fn latency_cb;
+    uint32_t mtu;
+    uint32_t pool_depth;
+    addr_t *group;
+    forward_fn forward_cb;
+    const struct socket_tune *tune;
+    /* 数据包中交错的声道数，为 0 时按单声道 */
+    uint32_t channels;
+    /* 只接收这个分组和 PCM_V2_GROUP_ANY 的 v2 包，为 PCM_V2_GROUP_ANY 时接收所有分组 */
+    uint8_t group_id;
+    /* 向服务端通告的协议版本，为 0 时使用 PCM_WIRE_VERSION */
+    uint8_t version;
 };
 
 int receiver_init(const struct receiver_config *cfg);
@@ -42,4 +110,25 @@ int receiver_start();
 
 int receiver_stop();
 
+int64_t receiver_drops();
+
+/**
+ * 处理其它输入路径收到的一个数据端口的包，直接在 package 上解码，package 只需要在调用期间有效
+ */
+int receiver_package(const struct sockaddr_storage *src, socklen_t src_len, const uint8_t *package, uint32_t len);
+
+/**
+ * 有其它线程调用 receiver_package 时设置，数据处理改为串行
+ */
+void receiver_set_shared(int shared);
+
+uint16_t receiver_port();
+
+void receiver_get_stats(struct receiver_stats *stats);
+
+/**
+ * 当前流使用的协议版本，1 或 2
+ */
+int receiver_wire_version();
+
 #endif // SPEAKER_RECEIVER_H
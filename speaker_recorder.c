@@ -0,0 +1,535 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef ESP_PLATFORM
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <semaphore.h>
+#include <pthread.h>
+#endif
+#include "speaker_recorder.h"
+#include "speaker_pcm.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_SNAPLEN 65535
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_IP_UDP_SIZE (20 + 8)
+
+/* 按本机字节序写入，读取方根据 magic 判断字节序 */
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_header_t;
+
+_Static_assert(sizeof(recorder_file_t) == 64, "recorder file header must be 64 bytes");
+_Static_assert(sizeof(recorder_record_t) == 32, "recorder record must be 32 bytes");
+
+static recorder_file_t *rec_file = NULL;
+static recorder_record_t *rec_ring = NULL;
+static size_t rec_size = 0;
+static char rec_path[256] = {0};
+// 记录文件所在的目录，转储文件只能保存在这里
+static char rec_dir[256] = RECORDER_DEFAULT_DIR;
+static output_queued_fn queued_fn = NULL;
+
+#ifndef ESP_PLATFORM
+static sem_t dump_sem;
+static pthread_t dump_thread;
+static volatile int dump_running = 0;
+#endif
+
+static const char *type_names[] = {
+  [REC_PACKET] = "packet",
+  [REC_GAP] = "gap",
+  [REC_LATE] = "late",
+  [REC_FORMAT] = "format",
+  [REC_OVERRUN] = "overrun",
+  [REC_UNDERRUN] = "underrun",
+  [REC_STANDBY] = "standby",
+  [REC_SCHEDULE_MISS] = "sched",
+};
+
+LOG_TAG_DECLR("recorder");
+
+static inline int64_t clock_usec(clockid_t id) {
+  struct timespec ts;
+
+  clock_gettime(id, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * 写入者之间只竞争 head，读取时可能看到正在写的记录，对事后分析没有影响
+ */
+static inline recorder_record_t *recorder_next() {
+  uint64_t index;
+
+  if (rec_file == NULL) return NULL;
+
+  index = atomic_fetch_add_explicit(&rec_file->head, 1, memory_order_relaxed);
+  return &rec_ring[index & (RECORDER_RECORDS - 1)];
+}
+
+static inline uint16_t recorder_queue() {
+  uint32_t msec = queued_fn ? queued_fn() / 1000 : 0;
+
+  return msec > UINT16_MAX ? UINT16_MAX : (uint16_t) msec;
+}
+
+void recorder_packet(uint8_t ver, const pcm_header_t *header, uint32_t seq, uint32_t ts, uint32_t latency,
+                     uint32_t src) {
+  recorder_record_t *r = recorder_next();
+
+  if (r == NULL) return;
+
+  r->usec = clock_usec(CLOCK_MONOTONIC);
+  r->type = REC_PACKET;
+  r->ver = ver;
+  r->rate = header->sample.rate;
+  r->bits = header->sample.bits;
+  r->len = header->len;
+  r->queue = recorder_queue();
+  r->seq = seq;
+  r->ts = ts;
+  r->value = latency;
+  r->src = src;
+}
+
+void recorder_event(uint8_t type, uint32_t value) {
+  recorder_record_t *r = recorder_next();
+
+  if (r == NULL) return;
+
+  memset(r, 0, sizeof(recorder_record_t));
+  r->usec = clock_usec(CLOCK_MONOTONIC);
+  r->type = type;
+  r->queue = recorder_queue();
+  r->value = value;
+}
+
+#ifndef ESP_PLATFORM
+static void *thread_dump(void *arg) {
+  char saved[300];
+
+  while (1) {
+    sem_wait(&dump_sem);
+    if (!dump_running) break;
+    if (recorder_dump(NULL, saved, sizeof(saved)) == 0) LOGI("recorder dump saved to %s", saved);
+  }
+
+  pthread_exit(NULL);
+}
+
+/**
+ * 默认目录不存在时创建，已存在时必须是当前用户的目录且其他人不可写
+ */
+static int recorder_private_dir() {
+  struct stat st;
+
+  if (strcmp(rec_dir, RECORDER_DEFAULT_DIR) != 0) return 0;
+
+  if (mkdir(rec_dir, 0700) < 0 && errno != EEXIST) {
+    LOGE("create recorder directory %s error: %m", rec_dir);
+    return -1;
+  }
+  if (lstat(rec_dir, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 022)) {
+    LOGE("recorder directory %s is not private", rec_dir);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void *recorder_map(const char *path) {
+  recorder_file_t old;
+  char prev[sizeof(rec_path) + 8];
+  void *mem;
+  int fd;
+
+  if (recorder_private_dir() != 0) return NULL;
+
+  // 保留上一次运行（可能是崩溃）的记录
+  fd = open(path, O_RDONLY | O_NOFOLLOW);
+  if (fd >= 0) {
+    if (read(fd, &old, sizeof(old)) == sizeof(old) && memcmp(old.magic, RECORDER_MAGIC, 8) == 0 && old.head) {
+      snprintf(prev, sizeof(prev), "%s.prev", path);
+      rename(path, prev);
+    }
+    close(fd);
+  }
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+  if (fd < 0) {
+    LOGE("open recorder %s error: %m", path);
+    return NULL;
+  }
+  if (ftruncate(fd, rec_size) < 0) {
+    LOGE("resize recorder %s error: %m", path);
+    close(fd);
+    return NULL;
+  }
+
+  mem = mmap(NULL, rec_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    LOGE("map recorder %s error: %m", path);
+    return NULL;
+  }
+
+  return mem;
+}
+#endif
+
+static void recorder_set_dir(const char *path) {
+  char *slash;
+
+  strncpy(rec_dir, path, sizeof(rec_dir) - 1);
+  slash = strrchr(rec_dir, '/');
+  if (slash == NULL) strcpy(rec_dir, ".");
+  else if (slash == rec_dir) slash[1] = '\0';
+  else *slash = '\0';
+}
+
+int recorder_init(const char *path) {
+  void *mem = NULL;
+
+  LOGT("recorder init");
+
+  rec_size = sizeof(recorder_file_t) + RECORDER_RECORDS * sizeof(recorder_record_t);
+
+#ifndef ESP_PLATFORM
+  if (path) {
+    strncpy(rec_path, path, sizeof(rec_path) - 1);
+    recorder_set_dir(rec_path);
+    mem = recorder_map(path);
+  }
+#endif
+  if (mem == NULL) {
+    rec_path[0] = '\0';
+    strcpy(rec_dir, RECORDER_DEFAULT_DIR);
+    mem = calloc(1, rec_size);
+    if (mem == NULL) return -1;
+  }
+
+  rec_ring = (recorder_record_t *) ((uint8_t *) mem + sizeof(recorder_file_t));
+  memcpy(((recorder_file_t *) mem)->magic, RECORDER_MAGIC, 8);
+  ((recorder_file_t *) mem)->record_size = sizeof(recorder_record_t);
+  ((recorder_file_t *) mem)->capacity = RECORDER_RECORDS;
+  ((recorder_file_t *) mem)->real_usec = clock_usec(CLOCK_REALTIME);
+  ((recorder_file_t *) mem)->mono_usec = clock_usec(CLOCK_MONOTONIC);
+  atomic_store(&((recorder_file_t *) mem)->head, 0);
+  rec_file = mem;
+
+#ifndef ESP_PLATFORM
+  sem_init(&dump_sem, 0, 0);
+  dump_running = 1;
+  if (0 != pthread_create(&dump_thread, NULL, thread_dump, NULL)) {
+    LOGW("recorder dump thread create error: %m");
+    dump_running = 0;
+  }
+#endif
+
+  LOGI("recorder %u records in %s", RECORDER_RECORDS, rec_path[0] ? rec_path : "memory");
+  return 0;
+}
+
+void recorder_deinit() {
+  recorder_file_t *file = rec_file;
+
+  LOGT("recorder deinit");
+
+  if (file == NULL) return;
+
+#ifndef ESP_PLATFORM
+  if (dump_running) {
+    dump_running = 0;
+    sem_post(&dump_sem);
+    pthread_join(dump_thread, NULL);
+  }
+  sem_destroy(&dump_sem);
+#endif
+
+  rec_file = NULL;
+  rec_ring = NULL;
+#ifndef ESP_PLATFORM
+  if (rec_path[0]) {
+    munmap(file, rec_size);
+    return;
+  }
+#endif
+  free(file);
+}
+
+void recorder_set_receiver(const addr_t *addr, uint16_t port) {
+  if (rec_file == NULL) return;
+
+  rec_file->addr = addr && addr->type == AF_INET ? addr->ipv4.s_addr : 0;
+  rec_file->port = port;
+}
+
+void recorder_set_queue(output_queued_fn fn) {
+  queued_fn = fn;
+}
+
+void recorder_dump_async() {
+#ifndef ESP_PLATFORM
+  if (dump_running) sem_post(&dump_sem);
+#endif
+}
+
+static inline uint64_t records_first(const recorder_file_t *file, uint64_t head) {
+  return head > file->capacity ? head - file->capacity : 0;
+}
+
+int recorder_dump(const char *name, char *saved, size_t saved_len) {
+  recorder_file_t header;
+  uint64_t head, i;
+  char path[sizeof(rec_dir) + 64];
+  const char *ring;
+  FILE *fp;
+  int fd, n;
+
+  if (rec_file == NULL) return -1;
+
+  if (name && (name[0] == '\0' || strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+    LOGE("dump name %s must be a file name", name);
+    return -1;
+  }
+
+  if (name == NULL) {
+    ring = strrchr(rec_path[0] ? rec_path : RECORDER_DEFAULT_PATH, '/');
+    ring = ring ? ring + 1 : rec_path;
+    n = snprintf(path, sizeof(path), "%s/%s.%lld", rec_dir, ring, (long long) time(NULL));
+  } else {
+    n = snprintf(path, sizeof(path), "%s/%s", rec_dir, name);
+  }
+  if (n < 0 || n >= (int) sizeof(path)) {
+    LOGE("dump name is too long");
+    return -1;
+  }
+
+#ifndef ESP_PLATFORM
+  if (recorder_private_dir() != 0) return -1;
+#endif
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+  fp = fd < 0 ? NULL : fdopen(fd, "wb");
+  if (fp == NULL) {
+    LOGE("open dump %s error: %m", path);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  // 按时间顺序展开，转储文件的 capacity 等于记录数
+  head = atomic_load(&rec_file->head);
+  memcpy(&header, rec_file, sizeof(header));
+  atomic_store(&header.head, head - records_first(rec_file, head));
+  header.capacity = (uint32_t) atomic_load(&header.head);
+  fwrite(&header, sizeof(header), 1, fp);
+  for (i = records_first(rec_file, head); i < head; i++) {
+    fwrite(&rec_ring[i % rec_file->capacity], sizeof(recorder_record_t), 1, fp);
+  }
+  fclose(fp);
+
+  if (saved) snprintf(saved, saved_len, "%s", path);
+  return 0;
+}
+
+static void print_time(FILE *out, const recorder_file_t *file, uint64_t usec) {
+  int64_t real = file->real_usec + ((int64_t) usec - file->mono_usec);
+  time_t sec = real / 1000000;
+  struct tm tm;
+  char buf[32];
+
+  localtime_r(&sec, &tm);
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+  fprintf(out, "%s.%06u", buf, (uint32_t) (real % 1000000));
+}
+
+static void print_record(FILE *out, const recorder_file_t *file, const recorder_record_t *r, uint64_t *last_packet) {
+  const uint8_t *ip = (const uint8_t *) &r->src;
+
+  print_time(out, file, r->usec);
+  fprintf(out, " %-8s", r->type < sizeof(type_names) / sizeof(type_names[0]) && type_names[r->type]
+                          ? type_names[r->type] : "unknown");
+
+  switch (r->type) {
+    case REC_PACKET:
+      fprintf(out, " +%-6llu v%u seq %u ts %u %d/%d len %u latency %uus src %u.%u.%u.%u",
+              (unsigned long long) (*last_packet ? r->usec - *last_packet : 0), r->ver, r->seq, r->ts,
+              rate_name(r->rate), bits_name(r->bits), r->len, r->value, ip[0], ip[1], ip[2], ip[3]);
+      *last_packet = r->usec;
+      break;
+    case REC_GAP:
+      fprintf(out, " lost %u packets", r->value);
+      break;
+    case REC_LATE:
+      fprintf(out, " behind %u packets", r->value);
+      break;
+    case REC_FORMAT:
+      fprintf(out, " %u/%u", r->value >> 8, r->value & 0xFF);
+      break;
+    case REC_OVERRUN:
+      fprintf(out, " dropped %u bytes", r->value);
+      break;
+    case REC_UNDERRUN:
+      fprintf(out, " latency %uus", r->value);
+      break;
+    case REC_STANDBY:
+      fprintf(out, " %s", r->value ? "enter" : "leave");
+      break;
+    case REC_SCHEDULE_MISS:
+      fprintf(out, " lead %uus exceeds output buffer", r->value);
+      break;
+    default:
+      break;
+  }
+  fprintf(out, " queue %ums\n", r->queue);
+}
+
+/**
+ * 还原出 IPv4/UDP 和记录时的包头，负载不保存，orig_len 为实际长度。
+ * v1 包头按 pcm_header_t 的布局还原，v2 没有记录 flags/group/channel。
+ * 记录只有 32 字节，不保存源端口，UDP 源端口为 0
+ */
+static void pcap_record(FILE *out, const recorder_file_t *file, const recorder_record_t *r) {
+  int64_t real = file->real_usec + ((int64_t) r->usec - file->mono_usec);
+  uint8_t pkt[PCAP_IP_UDP_SIZE + PCM_V2_HEADER_SIZE + sizeof(pcm_header_t)] = {0};
+  uint32_t rec[4], sum = 0, i, header_size;
+  pcm_header_v2_t v2 = {0};
+  pcm_header_t v1 = {0};
+
+  if (r->ver == 2) {
+    v2.rate = r->rate;
+    v2.bits = r->bits;
+    v2.len = r->len;
+    v2.seq = r->seq;
+    v2.ts = r->ts;
+    pcm_v2_encode(pkt + PCAP_IP_UDP_SIZE, &v2);
+    header_size = PCM_V2_HEADER_SIZE;
+  } else {
+    v1.sample.rate = r->rate;
+    v1.sample.bits = r->bits;
+    v1.len = r->len;
+    header_size = PCM_HEADER_SIZE < sizeof(v1) ? PCM_HEADER_SIZE : sizeof(v1);
+    memcpy(pkt + PCAP_IP_UDP_SIZE, &v1, header_size);
+  }
+
+  rec[0] = (uint32_t) (real / 1000000);
+  rec[1] = (uint32_t) (real % 1000000);
+  rec[2] = PCAP_IP_UDP_SIZE + header_size;
+  rec[3] = PCAP_IP_UDP_SIZE + header_size + r->len;
+
+  pkt[0] = 0x45;
+  pcm_store_be16(pkt + 2, PCAP_IP_UDP_SIZE + header_size + r->len);
+  pkt[8] = 64;
+  pkt[9] = 17;
+  memcpy(pkt + 12, &r->src, 4);
+  memcpy(pkt + 16, &file->addr, 4);
+  for (i = 0; i < 20; i += 2) sum += pkt[i] << 8 | pkt[i + 1];
+  while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  pcm_store_be16(pkt + 10, ~sum);
+
+  // 旧的记录文件没有端口
+  pcm_store_be16(pkt + 22, file->port ? file->port : DEFAULT_RECEIVER_PORT);
+  pcm_store_be16(pkt + 24, 8 + header_size + r->len);
+
+  fwrite(rec, sizeof(rec), 1, out);
+  fwrite(pkt, rec[2], 1, out);
+}
+
+static void export_records(FILE *out, const recorder_file_t *file, const recorder_record_t *ring, uint64_t head,
+                           uint32_t last, int pcap) {
+  pcap_header_t pcap_header = {
+    .magic = PCAP_MAGIC,
+    .version_major = PCAP_VERSION_MAJOR,
+    .version_minor = PCAP_VERSION_MINOR,
+    .snaplen = PCAP_SNAPLEN,
+    .network = PCAP_LINKTYPE_RAW,
+  };
+  uint64_t i = records_first(file, head), last_packet = 0;
+  const recorder_record_t *r;
+
+  if (last && head - i > last) i = head - last;
+
+  if (pcap) fwrite(&pcap_header, sizeof(pcap_header), 1, out);
+
+  for (; i < head; i++) {
+    r = &ring[i % file->capacity];
+    if (r->type == 0) continue;
+    if (!pcap) print_record(out, file, r, &last_packet);
+    else if (r->type == REC_PACKET) pcap_record(out, file, r);
+  }
+}
+
+void recorder_timeline(FILE *out, uint32_t last) {
+  if (rec_file == NULL) return;
+
+  export_records(out, rec_file, rec_ring, atomic_load(&rec_file->head), last, 0);
+}
+
+int recorder_export(const char *path, FILE *out, int pcap) {
+  recorder_file_t file;
+  recorder_record_t *ring;
+  uint64_t head;
+  FILE *fp;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    LOGE("open recorder %s error: %m", path);
+    return -1;
+  }
+
+  // 空的环形缓冲区转储后 capacity 和 head 都是 0
+  if (fread(&file, sizeof(file), 1, fp) != 1 || memcmp(file.magic, RECORDER_MAGIC, 8) != 0 ||
+      file.record_size != sizeof(recorder_record_t) || (file.capacity == 0 && atomic_load(&file.head) != 0)) {
+    LOGE("%s is not a recorder file", path);
+    fclose(fp);
+    return -1;
+  }
+
+  ring = calloc(file.capacity ? file.capacity : 1, sizeof(recorder_record_t));
+  if (ring == NULL) {
+    fclose(fp);
+    return -1;
+  }
+  head = atomic_load(&file.head);
+  if (fread(ring, sizeof(recorder_record_t), file.capacity, fp) != file.capacity) {
+    LOGW("%s is truncated", path);
+  }
+  fclose(fp);
+
+  export_records(out, &file, ring, head, 0, pcap);
+  free(ring);
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_RECORDER_H
+#define SPEAKER_RECORDER_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include "speaker.h"
+#include "speaker_receiver.h"
+
+#define RECORDER_MAGIC "CSREC01"
+/* 只有当前用户可以访问的目录，避免其它用户预先放置符号链接 */
+#define RECORDER_DEFAULT_DIR "/run/castspeaker"
+#define RECORDER_DEFAULT_PATH RECORDER_DEFAULT_DIR "/castspeaker.rec"
+
+#ifdef ESP_PLATFORM
+#define RECORDER_RECORDS 1024
+#else
+#define RECORDER_RECORDS 65536
+#endif
+
+enum recorder_type {
+    REC_PACKET = 1,
+    REC_GAP,
+    REC_LATE,
+    REC_FORMAT,
+    REC_OVERRUN,
+    REC_UNDERRUN,
+    REC_STANDBY,
+    REC_SCHEDULE_MISS,
+};
+
+/**
+ * 文件头，之后紧跟 capacity 个记录。head 是累计写入的记录数，
+ * real_usec/mono_usec 用来把单调时钟换算成墙上时间。
+ * addr（网络字节序的 IPv4，未知时为 0）和 port 为接收地址，导出 pcap 时作为目的地址
+ */
+typedef struct {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t capacity;
+    atomic_uint_fast64_t head;
+    int64_t real_usec;
+    int64_t mono_usec;
+    uint32_t addr;
+    uint16_t port;
+    uint8_t reserved[18];
+} recorder_file_t;
+
+/**
+ * 每条 32 字节。数据包记录的 value 为当时的输出延迟（微秒），
+ * 其它事件的 value 含义见 recorder_event 的调用处。
+ * queue 为输出缓冲区中排队的时长（毫秒），没有输出缓冲区时为 0
+ */
+typedef struct {
+    uint64_t usec;
+    uint8_t type;
+    uint8_t ver;
+    uint8_t rate;
+    uint8_t bits;
+    uint16_t len;
+    uint16_t queue;
+    uint32_t seq;
+    uint32_t ts;
+    uint32_t value;
+    uint32_t src;
+} recorder_record_t;
+
+/**
+ * 打开或创建 path 并映射为环形缓冲区，path 为 NULL 时只在内存中记录。
+ * 进程崩溃后文件中仍然保留最近的记录。path 不能是符号链接，
+ * 位于 RECORDER_DEFAULT_DIR 时会以 0700 权限创建该目录
+ */
+int recorder_init(const char *path);
+
+void recorder_deinit();
+
+void recorder_packet(uint8_t ver, const pcm_header_t *header, uint32_t seq, uint32_t ts, uint32_t latency,
+                     uint32_t src);
+
+void recorder_event(uint8_t type, uint32_t value);
+
+/**
+ * 记录接收地址和端口，导出 pcap 时作为目的地址。addr 为组播组或绑定的地址，
+ * 为 NULL 或不是 IPv4 时目的地址为 0
+ */
+void recorder_set_receiver(const addr_t *addr, uint16_t port);
+
+/**
+ * 每条记录的 queue 从这里读取
+ */
+void recorder_set_queue(output_queued_fn fn);
+
+/**
+ * 把当前的环形缓冲区按时间顺序保存到记录文件所在目录（只在内存中记录时为 RECORDER_DEFAULT_DIR）。
+ * name 只能是文件名，不能包含路径，为 NULL 时保存为 <ring>.<时间戳>
+ */
+int recorder_dump(const char *name, char *saved, size_t saved_len);
+
+/**
+ * 可以在信号处理函数中调用，由后台线程执行 recorder_dump
+ */
+void recorder_dump_async();
+
+/**
+ * 输出最近 last 条记录的时间线，last 为 0 时输出全部
+ */
+void recorder_timeline(FILE *out, uint32_t last);
+
+/**
+ * 把记录文件转换成文本时间线或 pcap，pcap 中的每个数据包只包含 IP/UDP 和原来版本的包头。
+ * 记录中没有源端口，UDP 源端口为 0
+ */
+int recorder_export(const char *path, FILE *out, int pcap);
+
+#endif
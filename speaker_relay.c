@@ -0,0 +1,391 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "common/utils.h"
+#include "common/connection.h"
+#include "common/event/select.h"
+#include "common/package/detect.h"
+#include "common/package/control.h"
+#include "common/error.h"
+#include "speaker_relay.h"
+#include "speaker_schedule.h"
+#include "speaker_receiver.h"
+#include "speaker_pcm.h"
+
+struct relay_speaker {
+    speaker_id_t id;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int channel;
+    time_t seen;
+};
+
+static interface_t iface = {0};
+static addr_t multicast_group = {0};
+static uint16_t multicast_port = 0;
+static addr_t data_group = {0};
+static uint16_t data_port = 0;
+
+static struct sockaddr_storage detect_addr, data_group_addr;
+static socklen_t detect_addr_len = 0, data_group_addr_len = 0;
+
+static struct relay_assign assign[RELAY_MAX_SPEAKERS];
+static uint32_t assign_len = 0;
+static struct socket_tune tune = {.dscp = -1, .priority = -1};
+
+/* 转发可能在 AF_XDP 线程中执行，下游扬声器表的读写都要持有 relay_mutex */
+static pthread_mutex_t relay_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t relay_cond = PTHREAD_COND_INITIALIZER;
+static struct relay_speaker speakers[RELAY_MAX_SPEAKERS];
+static int speakers_len = 0;
+
+#ifdef __linux__
+static struct mmsghdr msgs[RELAY_MAX_SPEAKERS];
+#endif
+static struct iovec iov;
+
+static socket_t down_fd = -1;
+static connection_t conn = DEFAULT_CONNECTION_UDP_INIT;
+static pthread_t expire_thread;
+static int expire_running = 0;
+
+LOG_TAG_DECLR("relay");
+
+static void relay_set_multicast_if(socket_t fd, const interface_t *ifc) {
+  unsigned char ttl = 1;
+  int loop = 0;
+
+  if (ifc->ip.type == AF_INET) {
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, (void *) &ifc->ip.ipv4, sizeof(struct in_addr));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, (void *) &ttl, sizeof(ttl));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, (void *) &loop, sizeof(loop));
+  } else {
+    setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, (void *) &ifc->ifindex, sizeof(ifc->ifindex));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, (void *) &ttl, sizeof(ttl));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, (void *) &loop, sizeof(loop));
+  }
+}
+
+static socket_t relay_send_socket(const interface_t *ifc) {
+  socket_t fd = socket(ifc->ip.type, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) {
+    LOGF("create socket error: %m");
+    sexit(EERR_SOCKET);
+  }
+
+  relay_set_multicast_if(fd, ifc);
+  socket_tune(fd, ifc->ip.type, &tune);
+  return fd;
+}
+
+/**
+ * 监听下游网段的发现请求，只接收下游网卡上的数据
+ */
+static socket_t relay_detect_socket() {
+  struct sockaddr_storage addr = {0};
+  struct ipv6_mreq imreq = {0};
+  addr_t any = {.type = iface.ip.type, .ipv6 = IN6ADDR_ANY_INIT};
+  socklen_t sock_len;
+  int reuse = 1, optlevel, optname;
+
+  socket_t fd = socket(iface.ip.type, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) {
+    LOGF("create socket error: %m");
+    sexit(EERR_SOCKET);
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *) &reuse, sizeof(reuse));
+#ifdef SO_BINDTODEVICE
+  if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, iface.name, strlen(iface.name)) < 0) {
+    LOGW("bind relay socket to %s failed: %m", iface.name);
+  }
+#endif
+
+  sock_len = set_sockaddr(&addr, &any, multicast_port);
+  if (bind(fd, (struct sockaddr *) &addr, sock_len) < 0) {
+    LOGF("relay bind error: %m");
+    closesocket(fd);
+    sexit(EERR_SOCKET);
+  }
+
+  if (iface.ip.type == AF_INET) {
+    ((struct ip_mreq *) &imreq)->imr_interface = iface.ip.ipv4;
+    ((struct ip_mreq *) &imreq)->imr_multiaddr = multicast_group.ipv4;
+    sock_len = sizeof(struct ip_mreq);
+    optlevel = IPPROTO_IP;
+    optname = IP_ADD_MEMBERSHIP;
+  } else {
+    imreq.ipv6mr_interface = iface.ifindex;
+    imreq.ipv6mr_multiaddr = multicast_group.ipv6;
+    sock_len = sizeof(struct ipv6_mreq);
+    optlevel = IPPROTO_IPV6;
+    optname = IPV6_ADD_MEMBERSHIP;
+  }
+  if (setsockopt(fd, optlevel, optname, (const void *) &imreq, sock_len) < 0) {
+    LOGF("Failed add to multicast group: %m");
+    closesocket(fd);
+    sexit(EERR_SOCKET);
+  }
+
+  return fd;
+}
+
+static void relay_expire(time_t now) {
+  int i;
+
+  for (i = 0; i < speakers_len;) {
+    if (now - speakers[i].seen > RELAY_SPEAKER_TIMEOUT) {
+      LOGI("relay speaker %u timeout", speakers[i].id);
+      speakers[i] = speakers[--speakers_len];
+    } else {
+      i++;
+    }
+  }
+}
+
+/**
+ * 没有扬声器上报时也要清理过期的条目，否则数据会一直发往已经离线的地址
+ */
+static void *thread_relay_expire(void *arg) {
+  struct timespec ts;
+
+  pthread_mutex_lock(&relay_mutex);
+  while (expire_running) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += RELAY_EXPIRE_INTERVAL;
+    pthread_cond_timedwait(&relay_cond, &relay_mutex, &ts);
+    relay_expire(time(NULL));
+  }
+  pthread_mutex_unlock(&relay_mutex);
+
+  return NULL;
+}
+
+static int relay_channel_of(speaker_id_t id) {
+  uint32_t i;
+
+  for (i = 0; i < assign_len; i++) {
+    if (assign[i].id == id) return assign[i].channel;
+  }
+  return RELAY_CHANNEL_ALL;
+}
+
+static void relay_update(const detect_request_t *req) {
+  time_t now = time(NULL);
+  int i;
+
+  for (i = 0; i < speakers_len; i++) {
+    if (speakers[i].id == req->id) break;
+  }
+  if (i == speakers_len) {
+    if (speakers_len >= RELAY_MAX_SPEAKERS) {
+      LOGW("relay speaker table full, ignore %u", req->id);
+      return;
+    }
+    speakers_len++;
+    speakers[i].channel = relay_channel_of(req->id);
+    if (speakers[i].channel == RELAY_CHANNEL_ALL) {
+      LOGI("relay speaker %u (%s):%d", req->id, addr_ntop(&req->addr), req->data_port);
+    } else {
+      LOGI("relay speaker %u (%s):%d channel %d", req->id, addr_ntop(&req->addr), req->data_port,
+           speakers[i].channel);
+    }
+  }
+
+  speakers[i].id = req->id;
+  speakers[i].seen = now;
+  speakers[i].addr_len = set_sockaddr(&speakers[i].addr, &req->addr, req->data_port);
+}
+
+/**
+ * 只记录下游扬声器，不向上游转发。中继自身的发现广播是服务端看到的唯一端点，
+ * 服务端只向中继发送一份数据，由中继按声道分发
+ */
+int relay_detect_read(connection_t *c, const struct sockaddr_storage *src, socklen_t src_len, const void *package,
+                      uint32_t len) {
+  sa_family_t sf = iface.ip.type;
+  detect_request_t req = {0};
+
+  if (len != DETECT_REQUEST_SIZE(sf)) return 0;
+
+  DETECT_REQUEST_DECODE(sf, &req, package);
+  pthread_mutex_lock(&relay_mutex);
+  relay_update(&req);
+  pthread_mutex_unlock(&relay_mutex);
+
+  return 0;
+}
+
+void relay_forward_detect(const void *package, uint32_t len) {
+  if (down_fd < 0) return;
+
+  if (sendto(down_fd, package, len, 0, (struct sockaddr *) &detect_addr, detect_addr_len) < 0) {
+    LOGD("relay detect forward error: %m");
+  }
+}
+
+/**
+ * @return 数据包的声道，控制包和调度包返回 RELAY_CHANNEL_ALL
+ */
+static int relay_package_channel(const uint8_t *package, uint32_t len) {
+  pcm_header_t header;
+
+  if (IS_SCHEDULE_PACKAGE(package, len)) return RELAY_CHANNEL_ALL;
+  // 版本由接收端在转发之前确定
+  if (receiver_wire_version() == 2) {
+    if (!IS_PCM_V2_PACKAGE(package, len)) return RELAY_CHANNEL_ALL;
+    if (package[offsetof(pcm_header_v2_t, flags)] & PCM_V2_FLAG_CONTROL) return RELAY_CHANNEL_ALL;
+    return package[offsetof(pcm_header_v2_t, channel)];
+  }
+  if (len == CONTROL_PACKAGE_SIZE || len < PCM_HEADER_SIZE) return RELAY_CHANNEL_ALL;
+
+  PCM_HEADER_DECODE(&header, package);
+  return header.sample.channel;
+}
+
+void relay_forward_data(const void *package, uint32_t len) {
+  int i, n = 0, sent, channel;
+
+  if (down_fd < 0) return;
+
+  if (data_group_addr_len) {
+    if (sendto(down_fd, package, len, 0, (struct sockaddr *) &data_group_addr, data_group_addr_len) < 0) {
+      LOGD("relay forward error: %m");
+    }
+    return;
+  }
+
+  channel = relay_package_channel(package, len);
+
+  pthread_mutex_lock(&relay_mutex);
+  iov.iov_base = (void *) package;
+  iov.iov_len = len;
+
+  // 每个扬声器只收自己声道的一份
+#ifdef __linux__
+  for (i = 0; i < speakers_len; i++) {
+    if (channel != RELAY_CHANNEL_ALL && speakers[i].channel != RELAY_CHANNEL_ALL && speakers[i].channel != channel) {
+      continue;
+    }
+    msgs[n].msg_hdr = (struct msghdr) {
+      .msg_name = &speakers[i].addr,
+      .msg_namelen = speakers[i].addr_len,
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+    };
+    n++;
+  }
+
+  for (i = 0; i < n; i += sent) {
+    sent = sendmmsg(down_fd, msgs + i, n - i, 0);
+    if (sent <= 0) {
+      LOGD("relay forward error: %m");
+      break;
+    }
+  }
+#else
+  for (i = 0; i < speakers_len; i++) {
+    if (channel != RELAY_CHANNEL_ALL && speakers[i].channel != RELAY_CHANNEL_ALL && speakers[i].channel != channel) {
+      continue;
+    }
+    sendto(down_fd, package, len, 0, (struct sockaddr *) &speakers[i].addr, speakers[i].addr_len);
+  }
+#endif
+  pthread_mutex_unlock(&relay_mutex);
+}
+
+int relay_init(const struct relay_config *cfg) {
+  LOGT("relay init");
+
+  if (cfg == NULL || cfg->iface == NULL) {
+    LOGE("relay iface can not empty");
+    return -1;
+  }
+  if (cfg->assign_len > RELAY_MAX_SPEAKERS) {
+    LOGE("relay too many channel assignments: %u", cfg->assign_len);
+    return -1;
+  }
+
+  iface = *cfg->iface;
+  assign_len = cfg->assign_len;
+  if (assign_len) memcpy(assign, cfg->assign, sizeof(struct relay_assign) * assign_len);
+  if (cfg->tune) {
+    // 发送 socket 不需要接收缓冲区和 busy poll
+    tune.dscp = cfg->tune->dscp;
+    tune.priority = cfg->tune->priority;
+  }
+  multicast_port = cfg->multicast_port ? cfg->multicast_port : DEFAULT_MULTICAST_PORT;
+  data_port = cfg->data_port ? cfg->data_port : DEFAULT_RECEIVER_PORT;
+  if (cfg->multicast_group) {
+    multicast_group = *cfg->multicast_group;
+  } else {
+    if (iface.ip.type == AF_INET) addr_stoa(&multicast_group, DEFAULT_MULTICAST_GROUP);
+    else addr_stoa(&multicast_group, DEFAULT_MULTICAST_GROUPV6);
+  }
+
+  detect_addr_len = set_sockaddr(&detect_addr, &multicast_group, multicast_port);
+  if (cfg->data_group) {
+    data_group = *cfg->data_group;
+    data_group_addr_len = set_sockaddr(&data_group_addr, &data_group, data_port);
+    LOGI("relay to group %s:%d on %s", addr_ntop(&data_group), data_port, iface.name);
+  } else {
+    LOGI("relay to speakers on %s", iface.name);
+  }
+
+  down_fd = relay_send_socket(&iface);
+
+  conn.family = iface.ip.type;
+  conn.read_cb = relay_detect_read;
+  conn.read_fd = relay_detect_socket();
+  event_add(&conn);
+
+  expire_running = 1;
+  if (0 != pthread_create(&expire_thread, NULL, thread_relay_expire, NULL)) {
+    LOGE("relay expire thread create error: %m");
+    expire_running = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void relay_deinit() {
+  LOGT("relay deinit");
+
+  if (down_fd < 0) return;
+
+  if (expire_running) {
+    pthread_mutex_lock(&relay_mutex);
+    expire_running = 0;
+    pthread_cond_signal(&relay_cond);
+    pthread_mutex_unlock(&relay_mutex);
+    pthread_join(expire_thread, NULL);
+  }
+
+  event_del(&conn);
+  closesocket(conn.read_fd);
+  closesocket(down_fd);
+  down_fd = -1;
+}
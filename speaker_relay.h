@@ -0,0 +1,68 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_RELAY_H
+#define SPEAKER_RELAY_H
+
+#include "speaker.h"
+
+#include "speaker_socket.h"
+
+#define RELAY_MAX_SPEAKERS 255
+#define RELAY_SPEAKER_TIMEOUT 180
+#define RELAY_EXPIRE_INTERVAL 30
+/* 未分配声道的扬声器接收所有声道 */
+#define RELAY_CHANNEL_ALL (-1)
+
+/**
+ * 下游扬声器的声道分配，转发时只发送该声道的数据包
+ */
+struct relay_assign {
+    speaker_id_t id;
+    int channel;
+};
+
+struct relay_config {
+    interface_t *iface;
+    addr_t *multicast_group;
+    uint16_t multicast_port;
+    addr_t *data_group;
+    uint16_t data_port;
+    const struct relay_assign *assign;
+    uint32_t assign_len;
+    /* 只使用 dscp 和 priority */
+    const struct socket_tune *tune;
+};
+
+int relay_init(const struct relay_config *cfg);
+
+void relay_deinit();
+
+/**
+ * 将上游收到的数据包转发到下游网段。PCM 包只发给分配了该声道的扬声器，
+ * 控制包和调度包发给所有扬声器
+ */
+void relay_forward_data(const void *package, uint32_t len);
+
+/**
+ * 将服务端的发现应答转发到下游网段
+ */
+void relay_forward_detect(const void *package, uint32_t len);
+
+#endif
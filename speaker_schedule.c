@@ -0,0 +1,215 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <time.h>
+#include "speaker_schedule.h"
+#include "speaker_recorder.h"
+
+#define SCHEDULE_RESYNC_USEC 1000000
+
+enum schedule_state {
+    STATE_PLAYING = 0,
+    STATE_ARMED,
+    STATE_STOPPING,
+    STATE_STOPPED,
+};
+
+static struct schedule_config sc_cfg = {0};
+static enum schedule_state state = STATE_PLAYING;
+static uint64_t target = 0;
+static uint64_t skip_frames = 0;
+static uint32_t misses = 0;
+
+static int64_t clock_offset = 0;
+static int clock_valid = 0;
+
+static const uint8_t silence[PACKAGE_MAX_SIZE] = {0};
+
+LOG_TAG_DECLR("schedule");
+
+static uint64_t local_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t load_be64(const uint8_t *p) {
+  uint64_t v = 0;
+  int i;
+  for (i = 0; i < 8; i++) v = v << 8 | p[i];
+  return v;
+}
+
+static inline uint64_t usec_to_frames(uint64_t usec, uint32_t rate) {
+  return usec * rate / 1000000;
+}
+
+int schedule_init(const struct schedule_config *cfg) {
+  LOGT("schedule init");
+
+  if (cfg == NULL || cfg->output_cb == NULL) {
+    LOGE("schedule output can not empty");
+    return -1;
+  }
+
+  sc_cfg = *cfg;
+  if (sc_cfg.channels == 0) sc_cfg.channels = 1;
+  state = STATE_PLAYING;
+
+  return 0;
+}
+
+uint64_t schedule_server_time() {
+  return local_time() + clock_offset;
+}
+
+/**
+ * 服务端时钟偏移取所有样本中的最大值，即网络延迟最小的那一次
+ */
+void schedule_command(const void *package, uint32_t len) {
+  const uint8_t *p = package;
+  schedule_package_t pkg;
+  int64_t est;
+
+  if (!IS_SCHEDULE_PACKAGE(package, len)) return;
+
+  pkg.magic = p[0];
+  pkg.cmd = p[1];
+  pkg.at = load_be64(p + 4);
+  pkg.now = load_be64(p + 12);
+
+  est = (int64_t) (pkg.now - local_time());
+  if (!clock_valid || est > clock_offset || clock_offset - est > SCHEDULE_RESYNC_USEC) {
+    clock_offset = est;
+    clock_valid = 1;
+  }
+  target = pkg.at - clock_offset;
+
+  switch (pkg.cmd) {
+    case SCHEDULE_START:
+      state = STATE_ARMED;
+      break;
+    case SCHEDULE_STOP:
+      if (state != STATE_STOPPED) state = STATE_STOPPING;
+      break;
+    case SCHEDULE_SEEK:
+      if (sc_cfg.flush_cb) sc_cfg.flush_cb();
+      state = STATE_ARMED;
+      break;
+    default:
+      LOGW("unknown schedule command: %d", pkg.cmd);
+      return;
+  }
+
+  LOGI("schedule: cmd %d at %lld, in %lldus", pkg.cmd, (long long) pkg.at,
+       (long long) ((int64_t) target - (int64_t) local_time()));
+}
+
+uint32_t schedule_misses() {
+  return misses;
+}
+
+/**
+ * 提前量全部以静音写入输出缓冲区，只能写到缓冲区的剩余空间，还要给当前数据包留出位置
+ */
+static uint64_t schedule_max_lead(uint32_t len, uint32_t rate, uint32_t frame_size) {
+  uint64_t max = SCHEDULE_MAX_LEAD_USEC, space;
+
+  if (sc_cfg.space_cb) {
+    space = sc_cfg.space_cb();
+    space = space > len ? (space - len) / frame_size : 0;
+    max = min(max, space * 1000000 / rate);
+  }
+  return max;
+}
+
+static int send_silence(const pcm_header_t *header, uint64_t frames, uint32_t frame_size) {
+  pcm_header_t h = *header;
+  uint64_t bytes = frames * frame_size, chunk;
+  uint64_t max_chunk = sizeof(silence) / frame_size * frame_size;
+
+  while (bytes > 0) {
+    chunk = min(bytes, max_chunk);
+    h.len = chunk;
+    if (sc_cfg.output_cb(&h, silence) != 0) return -1;
+    bytes -= chunk;
+  }
+  return 0;
+}
+
+int schedule_send(pcm_header_t *header, const uint8_t *data) {
+  uint32_t rate = rate_name(header->sample.rate);
+  uint32_t frame_size = sc_cfg.channels * (bits_name(header->sample.bits) / 8);
+  uint64_t frames, play_at, n, max_lead;
+  pcm_header_t h;
+
+  if (state == STATE_PLAYING && skip_frames == 0) return sc_cfg.output_cb(header, data);
+  if (state == STATE_STOPPED) return 0;
+  if (rate == 0 || frame_size == 0) return sc_cfg.output_cb(header, data);
+
+  frames = header->len / frame_size;
+  play_at = local_time() + (sc_cfg.latency_cb ? sc_cfg.latency_cb() : 0);
+
+  switch (state) {
+    case STATE_ARMED:
+      state = STATE_PLAYING;
+      if (target > play_at) {
+        max_lead = schedule_max_lead(header->len, rate, frame_size);
+        if (target - play_at > max_lead) {
+          misses++;
+          recorder_event(REC_SCHEDULE_MISS, target - play_at);
+          LOGE("schedule start %lluus ahead exceeds output buffer %lluus, start unaligned",
+               (unsigned long long) (target - play_at), (unsigned long long) max_lead);
+          break;
+        }
+        skip_frames = 0;
+        if (send_silence(header, usec_to_frames(target - play_at, rate), frame_size) != 0) return -1;
+      } else {
+        skip_frames = usec_to_frames(play_at - target, rate);
+        LOGD("schedule start late %llu frames", (unsigned long long) skip_frames);
+      }
+      break;
+    case STATE_STOPPING:
+      if (play_at >= target) {
+        state = STATE_STOPPED;
+        return 0;
+      }
+      n = usec_to_frames(target - play_at, rate);
+      if (n >= frames) break;
+
+      state = STATE_STOPPED;
+      h = *header;
+      h.len = n * frame_size;
+      return n ? sc_cfg.output_cb(&h, data) : 0;
+    default:
+      break;
+  }
+
+  if (skip_frames) {
+    n = min(skip_frames, frames);
+    skip_frames -= n;
+    if (n == frames) return 0;
+
+    h = *header;
+    h.len = (frames - n) * frame_size;
+    return sc_cfg.output_cb(&h, data + n * frame_size);
+  }
+
+  return sc_cfg.output_cb(header, data);
+}
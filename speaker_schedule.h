@@ -0,0 +1,79 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_SCHEDULE_H
+#define SPEAKER_SCHEDULE_H
+
+#include "speaker.h"
+#include "speaker_receiver.h"
+
+#define SCHEDULE_PACKAGE_MAGIC 0xA5
+#define SCHEDULE_PACKAGE_SIZE 20
+
+/*
+ * 超过这个提前量的开始命令视为时钟异常，直接开始播放。提前量用静音填充，
+ * 还受输出缓冲区剩余空间的限制
+ */
+#define SCHEDULE_MAX_LEAD_USEC 5000000
+
+enum schedule_cmd {
+    SCHEDULE_START = 1,
+    SCHEDULE_STOP,
+    SCHEDULE_SEEK,
+};
+
+/**
+ * 带播放时间的控制命令，时间均为服务端时钟的微秒数，网络字节序
+ *  0      1      2             4                   12                  20
+ *  +------+------+-------------+-------------------+-------------------+
+ *  | 0xA5 | cmd  |  reserved   |    at (u64)       |    now (u64)      |
+ *  +------+------+-------------+-------------------+-------------------+
+ */
+typedef struct {
+    uint8_t magic;
+    uint8_t cmd;
+    uint64_t at;
+    uint64_t now;
+} schedule_package_t;
+
+#define IS_SCHEDULE_PACKAGE(p, len) ((len) == SCHEDULE_PACKAGE_SIZE && ((const uint8_t *) (p))[0] == SCHEDULE_PACKAGE_MAGIC)
+
+struct schedule_config {
+    output_send_fn output_cb;
+    output_latency_fn latency_cb;
+    output_flush_fn flush_cb;
+    /* 为 NULL 时只按 SCHEDULE_MAX_LEAD_USEC 限制提前量 */
+    output_space_fn space_cb;
+    uint32_t channels;
+};
+
+int schedule_init(const struct schedule_config *cfg);
+
+void schedule_command(const void *package, uint32_t len);
+
+int schedule_send(pcm_header_t *header, const uint8_t *data);
+
+/**
+ * 开始命令的提前量超出输出缓冲区而没能对齐的次数
+ */
+uint32_t schedule_misses();
+
+uint64_t schedule_server_time();
+
+#endif
@@ -0,0 +1,142 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include "speaker_socket.h"
+
+LOG_TAG_DECLR("socket");
+
+static void socket_rcvbuf(socket_t fd, uint32_t size) {
+  int val = (int) size, got = 0;
+  socklen_t len = sizeof(got);
+
+#ifdef SO_RCVBUFFORCE
+  // 需要 CAP_NET_ADMIN，不受 net.core.rmem_max 限制
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, (void *) &val, sizeof(val)) == 0) return;
+#endif
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *) &val, sizeof(val)) < 0) {
+    LOGW("set rcvbuf %u error: %m", size);
+    return;
+  }
+
+  // linux 返回的是翻倍后的值
+  if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *) &got, &len) == 0 && (uint32_t) got < size) {
+    LOGW("rcvbuf limited to %d bytes, raise net.core.rmem_max to %u", got, size);
+  }
+}
+
+/**
+ * SO_BUSY_POLL 只对阻塞的 recv 生效，数据端口由接收线程阻塞读取；
+ * 事件层用 select() 等待的其它 socket 是否 busy poll 由 net.core.busy_poll 决定
+ */
+static void socket_busy_poll_check(uint32_t usec) {
+  static int checked = 0;
+  unsigned int sysctl = 0;
+  FILE *fp;
+
+  if (checked) return;
+  checked = 1;
+
+  fp = fopen("/proc/sys/net/core/busy_poll", "r");
+  if (fp == NULL) return;
+  if (fscanf(fp, "%u", &sysctl) != 1) sysctl = 0;
+  fclose(fp);
+
+  if (sysctl == 0) {
+    LOGW("net.core.busy_poll is 0, only the data socket will busy poll. Run 'sysctl -w net.core.busy_poll=%u'", usec);
+  } else {
+    LOGI("busy poll %uus, net.core.busy_poll %uus", usec, sysctl);
+  }
+}
+
+int socket_tune(socket_t fd, sa_family_t family, const struct socket_tune *tune) {
+  int val;
+
+  if (tune == NULL) return 0;
+
+  if (tune->rcvbuf) socket_rcvbuf(fd, tune->rcvbuf);
+
+  if (tune->busy_poll_usec) {
+    socket_busy_poll_check(tune->busy_poll_usec);
+#ifdef SO_BUSY_POLL
+    val = (int) tune->busy_poll_usec;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, (void *) &val, sizeof(val)) < 0) {
+      LOGW("set busy poll error: %m");
+    }
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    val = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (void *) &val, sizeof(val)) < 0) {
+      LOGD("set prefer busy poll error: %m");
+    }
+#endif
+  }
+
+  if (tune->dscp >= 0) {
+    val = tune->dscp << 2;
+    if (family == AF_INET) {
+      if (setsockopt(fd, IPPROTO_IP, IP_TOS, (void *) &val, sizeof(val)) < 0) LOGW("set tos error: %m");
+    }
+#ifdef IPV6_TCLASS
+    else if (setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, (void *) &val, sizeof(val)) < 0) {
+      LOGW("set tclass error: %m");
+    }
+#endif
+  }
+
+#ifdef SO_PRIORITY
+  if (tune->priority >= 0) {
+    val = tune->priority;
+    if (setsockopt(fd, SOL_SOCKET, SO_PRIORITY, (void *) &val, sizeof(val)) < 0) LOGW("set priority error: %m");
+  }
+#endif
+
+  return 0;
+}
+
+int64_t socket_drops(socket_t fd, sa_family_t family) {
+#ifdef __linux__
+  struct stat st;
+  unsigned long inode;
+  unsigned int drops;
+  char line[256];
+  int64_t ret = -1;
+  FILE *fp;
+
+  if (fstat(fd, &st) < 0) return -1;
+
+  fp = fopen(family == AF_INET6 ? "/proc/net/udp6" : "/proc/net/udp", "r");
+  if (fp == NULL) return -1;
+
+  // sl local rem st tx:rx tr:when retrnsmt uid timeout inode ref pointer drops
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, " %*d: %*s %*s %*x %*s %*s %*x %*u %*u %lu %*d %*s %u", &inode, &drops) != 2) continue;
+    if (inode == st.st_ino) {
+      ret = drops;
+      break;
+    }
+  }
+  fclose(fp);
+
+  return ret;
+#else
+  return -1;
+#endif
+}
@@ -0,0 +1,58 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_SOCKET_H
+#define SPEAKER_SOCKET_H
+
+#include "speaker.h"
+
+/* 最高的流格式 192kHz/32bit 单声道每秒的字节数 */
+#define SOCKET_MAX_BYTE_RATE (192000 * 4)
+#define SOCKET_DSCP_EF 46
+#define SOCKET_PRIORITY_AUDIO 6
+/* 数据端口阻塞读取时直接生效，select() 等待的 socket 还需要 sysctl net.core.busy_poll 非 0 */
+#define SOCKET_BUSY_POLL_USEC 50
+#define SOCKET_JITTER_USEC 200000
+#define SOCKET_JITTER_LOW_USEC 20000
+
+struct socket_tune {
+    uint32_t rcvbuf;
+    uint32_t busy_poll_usec;
+    int dscp;
+    int priority;
+};
+
+/**
+ * 按抖动缓冲的时长估算接收缓冲区，内核按 skb 实际占用计算，预留一倍
+ */
+#define SOCKET_RCVBUF_FOR(usec) ((uint32_t) ((uint64_t) (usec) * SOCKET_MAX_BYTE_RATE / 1000000 * 2))
+
+/**
+ * 接收缓冲区、busy poll、DSCP 和 SO_PRIORITY，平台不支持的选项跳过
+ */
+int socket_tune(socket_t fd, sa_family_t family, const struct socket_tune *tune);
+
+/**
+ * 内核因接收队列满而丢弃的数据包数。接收线程不读取 SO_RXQ_OVFL 的
+ * 控制消息，这里从 /proc/net/udp 按 socket inode 读取同一个计数
+ * @return -1 表示不支持
+ */
+int64_t socket_drops(socket_t fd, sa_family_t family);
+
+#endif
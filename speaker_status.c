@@ -0,0 +1,163 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include "speaker_status.h"
+
+struct status_command {
+    const char *name;
+    const char *help;
+    status_cmd_fn fn;
+};
+
+static struct status_command commands[STATUS_MAX_COMMANDS];
+static int commands_len = 0;
+
+static char sock_path[sizeof(((struct sockaddr_un *) 0)->sun_path)] = {0};
+static int listen_fd = -1;
+static pthread_t status_thread;
+
+LOG_TAG_DECLR("status");
+
+static void status_help(FILE *out, const char *arg) {
+  int i;
+
+  fprintf(out, "%-12s %s\n", "help", "List commands.");
+  for (i = 0; i < commands_len; i++) {
+    fprintf(out, "%-12s %s\n", commands[i].name, commands[i].help);
+  }
+}
+
+int status_register(const char *name, const char *help, status_cmd_fn fn) {
+  if (commands_len >= STATUS_MAX_COMMANDS) {
+    LOGE("too many status commands, ignore %s", name);
+    return -1;
+  }
+
+  commands[commands_len].name = name;
+  commands[commands_len].help = help;
+  commands[commands_len].fn = fn;
+  commands_len++;
+
+  return 0;
+}
+
+static void status_dispatch(int fd) {
+  char line[STATUS_LINE_SIZE] = {0};
+  char *cmd, *arg = NULL, *save = NULL;
+  struct timeval tv = {.tv_sec = 1};
+  ssize_t s;
+  FILE *out;
+  int i;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (void *) &tv, sizeof(tv));
+  s = recv(fd, line, sizeof(line) - 1, 0);
+  if (s < 0) s = 0;
+  line[s] = 0;
+
+  out = fdopen(fd, "w");
+  if (out == NULL) {
+    closesocket(fd);
+    return;
+  }
+
+  cmd = strtok_r(line, " \t\r\n", &save);
+  if (cmd == NULL) cmd = "status";
+  else arg = strtok_r(NULL, "\r\n", &save);
+
+  for (i = 0; i < commands_len; i++) {
+    if (strcmp(commands[i].name, cmd) == 0) {
+      commands[i].fn(out, arg);
+      break;
+    }
+  }
+  if (i == commands_len) {
+    if (strcmp(cmd, "help") == 0) status_help(out, arg);
+    else fprintf(out, "unknown command: %s\n", cmd);
+  }
+
+  fclose(out);
+}
+
+static void *thread_status(void *arg) {
+  int fd;
+
+  while (!exit_thread_flag) {
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    status_dispatch(fd);
+  }
+
+  pthread_exit(NULL);
+}
+
+int status_init(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+  LOGT("status init");
+
+  if (path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+    LOGE("invalid status socket path");
+    return -1;
+  }
+  strcpy(sock_path, path);
+  strcpy(addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    LOGE("create status socket error: %m");
+    return -1;
+  }
+
+  unlink(sock_path);
+  if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) {
+    LOGE("status socket %s error: %m", sock_path);
+    closesocket(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  if (0 != pthread_create(&status_thread, NULL, thread_status, NULL)) {
+    LOGE("status thread create error: %m");
+    closesocket(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  LOGI("status on %s", sock_path);
+  return 0;
+}
+
+void status_deinit() {
+  LOGT("status deinit");
+
+  if (listen_fd < 0) return;
+
+  shutdown(listen_fd, SHUT_RDWR);
+  closesocket(listen_fd);
+  listen_fd = -1;
+  pthread_join(status_thread, NULL);
+  unlink(sock_path);
+}
@@ -0,0 +1,41 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPEAKER_STATUS_H
+#define SPEAKER_STATUS_H
+
+#include <stdio.h>
+#include "speaker.h"
+
+#define STATUS_MAX_COMMANDS 16
+#define STATUS_LINE_SIZE 256
+
+typedef void (*status_cmd_fn)(FILE *out, const char *arg);
+
+/**
+ * 本地状态接口，客户端通过 unix socket 发送一行命令，返回文本结果，
+ * 例如 echo status | nc -U /tmp/castspeaker.sock
+ */
+int status_init(const char *path);
+
+void status_deinit();
+
+int status_register(const char *name, const char *help, status_cmd_fn fn);
+
+#endif
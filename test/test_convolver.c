@@ -0,0 +1,174 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "test.h"
+#include "dsp/fft.h"
+#include "dsp/convolver.h"
+
+#define TEST_FFT_SIZE 256
+#define TEST_CV_TAPS 300
+#define TEST_CV_BLOCK 128
+#define TEST_CV_FRAMES 4000
+
+static float random_sample() {
+  return (float) rand() / RAND_MAX - 0.5f;
+}
+
+START_TEST(test_fft_dft)
+  {
+    static float x[TEST_FFT_SIZE], re[TEST_FFT_SIZE / 2 + 1], im[TEST_FFT_SIZE / 2 + 1];
+    fft_t *f = fft_create(TEST_FFT_SIZE);
+    double dr, di;
+    size_t i, k;
+
+    ck_assert_ptr_nonnull(f);
+    for (i = 0; i < TEST_FFT_SIZE; i++) x[i] = random_sample();
+    fft_forward(f, x, re, im);
+
+    // 与直接计算的 DFT 比较，包括 0 和 n/2 两个实数点
+    for (k = 0; k <= TEST_FFT_SIZE / 2; k++) {
+      dr = di = 0;
+      for (i = 0; i < TEST_FFT_SIZE; i++) {
+        dr += x[i] * cos(2 * M_PI * k * i / TEST_FFT_SIZE);
+        di -= x[i] * sin(2 * M_PI * k * i / TEST_FFT_SIZE);
+      }
+      ck_assert_double_eq_tol(re[k], dr, 1e-3);
+      ck_assert_double_eq_tol(im[k], di, 1e-3);
+    }
+    fft_destroy(f);
+  }
+END_TEST
+
+START_TEST(test_fft_inverse)
+  {
+    static float x[TEST_FFT_SIZE], y[TEST_FFT_SIZE], re[TEST_FFT_SIZE / 2 + 1], im[TEST_FFT_SIZE / 2 + 1];
+    fft_t *f = fft_create(TEST_FFT_SIZE);
+    size_t i;
+
+    ck_assert_ptr_nonnull(f);
+    for (i = 0; i < TEST_FFT_SIZE; i++) x[i] = random_sample();
+    fft_forward(f, x, re, im);
+    fft_inverse(f, re, im, y);
+
+    // 逆变换不归一化，结果为 n/2 倍
+    for (i = 0; i < TEST_FFT_SIZE; i++) ck_assert_double_eq_tol(y[i] / (TEST_FFT_SIZE / 2), x[i], 1e-5);
+    fft_destroy(f);
+  }
+END_TEST
+
+START_TEST(test_convolver_direct)
+  {
+    static float h[TEST_CV_TAPS], x[2][TEST_CV_FRAMES], y[2][TEST_CV_FRAMES];
+    float *data[2];
+    convolver_t *c;
+    size_t i, k, n, chunk;
+    uint32_t ch;
+    double expect;
+
+    for (i = 0; i < TEST_CV_TAPS; i++) h[i] = random_sample();
+    for (ch = 0; ch < 2; ch++) {
+      for (i = 0; i < TEST_CV_FRAMES; i++) x[ch][i] = y[ch][i] = random_sample();
+    }
+    c = convolver_create(h, TEST_CV_TAPS, TEST_CV_BLOCK, 2);
+    ck_assert_ptr_nonnull(c);
+
+    // 数据包长度与块大小无关，用不规则的长度分段送入
+    for (i = 0, chunk = 1; i < TEST_CV_FRAMES; i += n, chunk = chunk * 7 % 251 + 1) {
+      n = TEST_CV_FRAMES - i < chunk ? TEST_CV_FRAMES - i : chunk;
+      data[0] = y[0] + i;
+      data[1] = y[1] + i;
+      convolver_process(c, data, n);
+    }
+
+    // 输出比直接卷积延迟一个块
+    for (ch = 0; ch < 2; ch++) {
+      for (i = TEST_CV_BLOCK; i < TEST_CV_FRAMES; i++) {
+        expect = 0;
+        for (k = 0; k < TEST_CV_TAPS && k <= i - TEST_CV_BLOCK; k++) expect += h[k] * x[ch][i - TEST_CV_BLOCK - k];
+        ck_assert_double_eq_tol(y[ch][i], expect, 1e-3);
+      }
+    }
+    convolver_destroy(c);
+  }
+END_TEST
+
+START_TEST(test_convolver_reset)
+  {
+    static float h[TEST_CV_TAPS], x[TEST_CV_BLOCK * 8];
+    float *data = x;
+    convolver_t *c;
+    size_t i;
+
+    for (i = 0; i < TEST_CV_TAPS; i++) h[i] = random_sample();
+    c = convolver_create(h, TEST_CV_TAPS, TEST_CV_BLOCK, 1);
+    ck_assert_ptr_nonnull(c);
+
+    for (i = 0; i < TEST_CV_BLOCK * 8; i++) x[i] = random_sample();
+    convolver_process(c, &data, TEST_CV_BLOCK * 8);
+
+    // 清空之后送入静音，不能再输出之前信号的尾音
+    convolver_reset(c);
+    for (i = 0; i < TEST_CV_BLOCK * 8; i++) x[i] = 0;
+    convolver_process(c, &data, TEST_CV_BLOCK * 8);
+    for (i = 0; i < TEST_CV_BLOCK * 8; i++) ck_assert_float_eq_tol(x[i], 0, 1e-6);
+    convolver_destroy(c);
+  }
+END_TEST
+
+START_TEST(test_fir_load_rate)
+  {
+    char path[] = "/tmp/castspeaker-fir-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *fp;
+    float *taps;
+    size_t len = 0;
+    uint32_t rate = 1;
+
+    ck_assert_int_ge(fd, 0);
+    fp = fdopen(fd, "w");
+    fprintf(fp, "# room correction\n0.5\n# rate 48000\n-0.25\n0.125\n");
+    fclose(fp);
+
+    taps = fir_load_file(path, &len, &rate);
+    unlink(path);
+    ck_assert_ptr_nonnull(taps);
+    ck_assert_uint_eq(len, 3);
+    ck_assert_uint_eq(rate, 48000);
+    ck_assert_float_eq(taps[1], -0.25f);
+    free(taps);
+  }
+END_TEST
+
+Suite *convolver_suite() {
+  Suite *s = suite_create("convolver");
+  TCase *tc = tcase_create("core");
+
+  tcase_add_test(tc, test_fft_dft);
+  tcase_add_test(tc, test_fft_inverse);
+  tcase_add_test(tc, test_convolver_direct);
+  tcase_add_test(tc, test_convolver_reset);
+  tcase_add_test(tc, test_fir_load_rate);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
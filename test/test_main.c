@@ -18,11 +18,21 @@
 
 
 #include <stdlib.h>
-#include "check.h"
-
+#include "test.h"
 
 int main(void) {
-  int ret = 0;
+  int failed;
+  SRunner *sr = srunner_create(pool_suite());
+
+  srunner_add_suite(sr, resample_suite());
+  srunner_add_suite(sr, convolver_suite());
+  srunner_add_suite(sr, pcm_suite());
+  srunner_add_suite(sr, workers_suite());
+  srunner_add_suite(sr, recorder_suite());
+
+  srunner_run_all(sr, CK_NORMAL);
+  failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
 
-  return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
-}
\ No newline at end of file
+  return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,188 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <string.h>
+#include "test.h"
+#include "speaker_pcm.h"
+
+START_TEST(test_pcm_v2_layout)
+  {
+    static const uint8_t wire[PCM_V2_HEADER_SIZE] = {
+      0xC2, 0x03, 0x07, 0x02, 0x11, 0x22, 0x01, 0x80, 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0,
+    };
+    pcm_header_v2_t h;
+
+    ck_assert(IS_PCM_V2_PACKAGE(wire, sizeof(wire)));
+    ck_assert(!IS_PCM_V2_PACKAGE(wire, sizeof(wire) - 1));
+
+    // 多字节字段为网络字节序，逐字节解码不要求对齐
+    pcm_v2_decode(&h, wire);
+    ck_assert_uint_eq(h.magic, PCM_V2_MAGIC);
+    ck_assert_uint_eq(h.flags, PCM_V2_FLAG_START | PCM_V2_FLAG_CONTROL);
+    ck_assert_uint_eq(h.group, 7);
+    ck_assert_uint_eq(h.channel, 2);
+    ck_assert_uint_eq(h.rate, 0x11);
+    ck_assert_uint_eq(h.bits, 0x22);
+    ck_assert_uint_eq(h.len, 0x0180);
+    ck_assert_uint_eq(h.seq, 0x12345678);
+    ck_assert_uint_eq(h.ts, 0x9ABCDEF0);
+  }
+END_TEST
+
+START_TEST(test_pcm_v2_roundtrip)
+  {
+    uint8_t buf[PCM_V2_HEADER_SIZE + 1];
+    pcm_header_v2_t in = {
+      .flags = PCM_V2_FLAG_START, .group = 3, .channel = 5, .rate = 2, .bits = 1,
+      .len = 1440, .seq = 0xFFFFFFFF, .ts = 123456789,
+    }, out;
+
+    // 从奇数地址编解码
+    pcm_v2_encode(buf + 1, &in);
+    pcm_v2_decode(&out, buf + 1);
+    in.magic = PCM_V2_MAGIC;
+    ck_assert_mem_eq(&in, &out, sizeof(pcm_header_v2_t));
+  }
+END_TEST
+
+static enum pcm_seq_result seq_next(pcm_seq_t *s, uint32_t seq, int start, uint32_t *count, int64_t *lost) {
+  // 每个包 100 帧
+  return pcm_seq_next(s, seq, seq * 100, 100, start, count, lost);
+}
+
+START_TEST(test_pcm_seq_order)
+  {
+    pcm_seq_t s = {0};
+    uint32_t count;
+    int64_t lost;
+
+    ck_assert_int_eq(seq_next(&s, 10, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+    ck_assert_int_eq(seq_next(&s, 11, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+
+    ck_assert_int_eq(seq_next(&s, 14, 0, &count, &lost), PCM_SEQ_GAP);
+    ck_assert_uint_eq(count, 2);
+    ck_assert_int_eq(lost, 200);
+
+    // 丢失的包之后才到达，丢弃
+    ck_assert_int_eq(seq_next(&s, 12, 0, &count, &lost), PCM_SEQ_LATE);
+    ck_assert_uint_eq(count, 3);
+    ck_assert_int_eq(seq_next(&s, 15, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+
+    // 序号回绕
+    s.next_seq = 0xFFFFFFFF;
+    ck_assert_int_eq(seq_next(&s, 0xFFFFFFFF, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+    ck_assert_int_eq(seq_next(&s, 0, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+  }
+END_TEST
+
+START_TEST(test_pcm_seq_resync)
+  {
+    pcm_seq_t s = {0};
+    uint32_t count, i;
+    int64_t lost;
+
+    ck_assert_int_eq(seq_next(&s, 5000, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+
+    // 服务端重启后序号大幅倒退，不能把之后的包都当作迟到
+    ck_assert_int_eq(seq_next(&s, 3, 0, &count, &lost), PCM_SEQ_RESYNC);
+    ck_assert_int_eq(seq_next(&s, 4, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+
+    // 大幅前跳也重新开始，不补静音
+    ck_assert_int_eq(seq_next(&s, 4 + PCM_SEQ_RESYNC_JUMP + 2, 0, &count, &lost), PCM_SEQ_RESYNC);
+    ck_assert_int_eq(lost, 0);
+
+    // 小幅倒退连续出现，达到次数后重新开始
+    s.next_seq = 100;
+    for (i = 0; i < PCM_SEQ_RESYNC_LATE - 1; i++) {
+      ck_assert_int_eq(seq_next(&s, 90 + i, 0, &count, &lost), PCM_SEQ_LATE);
+    }
+    ck_assert_int_eq(seq_next(&s, 90 + i, 0, &count, &lost), PCM_SEQ_RESYNC);
+    ck_assert_int_eq(seq_next(&s, 91 + i, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+
+    // 中间有正常的包时迟到计数清零
+    for (i = 0; i < PCM_SEQ_RESYNC_LATE - 1; i++) {
+      ck_assert_int_eq(seq_next(&s, 50, 0, &count, &lost), PCM_SEQ_LATE);
+    }
+    ck_assert_int_eq(seq_next(&s, s.next_seq, 0, &count, &lost), PCM_SEQ_IN_ORDER);
+    ck_assert_int_eq(seq_next(&s, 50, 0, &count, &lost), PCM_SEQ_LATE);
+
+    // START 标志直接重新开始
+    ck_assert_int_eq(seq_next(&s, 7, 1, &count, &lost), PCM_SEQ_IN_ORDER);
+    ck_assert_uint_eq(s.next_seq, 8);
+  }
+END_TEST
+
+/**
+ * 按接收端的方式把丢失的帧切成多块，返回总字节数
+ */
+static uint64_t conceal_total(int64_t frames, uint32_t frame_size, uint32_t max_bytes, uint32_t *chunks) {
+  uint64_t total = 0;
+  uint32_t len;
+
+  *chunks = 0;
+  while ((len = pcm_conceal_bytes(frames, frame_size, max_bytes)) > 0) {
+    ck_assert_uint_eq(len % frame_size, 0);
+    ck_assert_uint_le(len, max_bytes);
+    frames -= len / frame_size;
+    total += len;
+    (*chunks)++;
+  }
+  ck_assert_int_eq(frames, 0);
+
+  return total;
+}
+
+START_TEST(test_pcm_conceal_channels)
+  {
+    const uint32_t max_bytes = 1500 - PCM_V2_HEADER_SIZE;
+    pcm_seq_t s = {0};
+    uint32_t count, chunks;
+    int64_t lost;
+
+    // 立体声 24 位，每包 240 帧，丢了 3 个包
+    ck_assert_int_eq(pcm_seq_next(&s, 0, 0, 240, 1, &count, &lost), PCM_SEQ_IN_ORDER);
+    ck_assert_int_eq(pcm_seq_next(&s, 4, 960, 240, 0, &count, &lost), PCM_SEQ_GAP);
+    ck_assert_int_eq(lost, 720);
+    ck_assert_uint_eq(conceal_total(lost, 2 * 3, max_bytes, &chunks), 720 * 2 * 3);
+    ck_assert_uint_eq(chunks, 3);
+
+    // 6 声道 16 位，块大小不是帧长的整数倍时也按整帧切
+    ck_assert_uint_eq(conceal_total(1000, 6 * 2, max_bytes, &chunks), 1000 * 6 * 2);
+    ck_assert_uint_eq(pcm_conceal_bytes(1000, 6 * 2, max_bytes), max_bytes / 12 * 12);
+
+    // 放不下一帧时不输出
+    ck_assert_uint_eq(pcm_conceal_bytes(10, 8, 4), 0);
+    ck_assert_uint_eq(pcm_conceal_bytes(0, 8, max_bytes), 0);
+  }
+END_TEST
+
+Suite *pcm_suite() {
+  Suite *s = suite_create("pcm");
+  TCase *tc = tcase_create("core");
+
+  tcase_add_test(tc, test_pcm_v2_layout);
+  tcase_add_test(tc, test_pcm_v2_roundtrip);
+  tcase_add_test(tc, test_pcm_seq_order);
+  tcase_add_test(tc, test_pcm_seq_resync);
+  tcase_add_test(tc, test_pcm_conceal_channels);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,140 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include "test.h"
+#include "speaker_pool.h"
+
+#define TEST_POOL_DEPTH 8
+#define TEST_POOL_MTU 256
+#define TEST_POOL_THREADS 4
+#define TEST_POOL_ROUNDS 100000
+
+static void pool_setup() {
+  struct pool_config cfg = {.mtu = TEST_POOL_MTU, .depth = TEST_POOL_DEPTH};
+
+  ck_assert_int_eq(pool_init(&cfg), 0);
+}
+
+static void pool_teardown() {
+  pool_deinit();
+}
+
+START_TEST(test_pool_exhaust)
+  {
+    pool_slot_t *slots[TEST_POOL_DEPTH];
+    struct pool_stats stats;
+    int i, j;
+
+    for (i = 0; i < TEST_POOL_DEPTH; i++) {
+      slots[i] = pool_acquire();
+      ck_assert_ptr_nonnull(slots[i]);
+      ck_assert_int_eq((uintptr_t) slots[i]->data % 16, 0);
+      for (j = 0; j < i; j++) ck_assert_ptr_ne(slots[i], slots[j]);
+    }
+    ck_assert_ptr_null(pool_acquire());
+
+    pool_get_stats(&stats);
+    ck_assert_int_eq(stats.depth, TEST_POOL_DEPTH);
+    ck_assert_int_eq(stats.in_use, TEST_POOL_DEPTH);
+    ck_assert_int_eq(stats.high_water, TEST_POOL_DEPTH);
+    ck_assert_int_eq(stats.exhausted, 1);
+
+    for (i = 0; i < TEST_POOL_DEPTH; i++) pool_release(slots[i]);
+
+    pool_get_stats(&stats);
+    ck_assert_int_eq(stats.in_use, 0);
+    ck_assert_int_eq(stats.high_water, TEST_POOL_DEPTH);
+  }
+END_TEST
+
+START_TEST(test_pool_refs)
+  {
+    pool_slot_t *slot = pool_acquire(), *again;
+    struct pool_stats stats;
+
+    ck_assert_ptr_nonnull(slot);
+    pool_ref(slot);
+    pool_release(slot);
+
+    pool_get_stats(&stats);
+    ck_assert_int_eq(stats.in_use, 1);
+
+    pool_release(slot);
+    pool_get_stats(&stats);
+    ck_assert_int_eq(stats.in_use, 0);
+
+    // 最后释放的槽位最先被取出，缓存中仍是热的
+    again = pool_acquire();
+    ck_assert_ptr_eq(again, slot);
+    ck_assert_ptr_eq(POOL_SLOT_OF(&again->header), again);
+    pool_release(again);
+  }
+END_TEST
+
+static void *pool_worker(void *arg) {
+  uintptr_t id = (uintptr_t) arg, errors = 0;
+  pool_slot_t *slot;
+  int i;
+
+  for (i = 0; i < TEST_POOL_ROUNDS; i++) {
+    slot = pool_acquire();
+    if (slot == NULL) continue;
+    // 同一个槽位被两个线程同时持有时，这里写入的标记会被覆盖
+    memset(slot->data, (int) id, TEST_POOL_MTU);
+    if (slot->data[0] != (uint8_t) id || slot->data[TEST_POOL_MTU - 1] != (uint8_t) id) errors++;
+    pool_release(slot);
+  }
+
+  return (void *) errors;
+}
+
+START_TEST(test_pool_threads)
+  {
+    pthread_t threads[TEST_POOL_THREADS];
+    struct pool_stats stats;
+    void *errors;
+    uintptr_t i;
+
+    for (i = 0; i < TEST_POOL_THREADS; i++) {
+      ck_assert_int_eq(pthread_create(&threads[i], NULL, pool_worker, (void *) (i + 1)), 0);
+    }
+    for (i = 0; i < TEST_POOL_THREADS; i++) {
+      pthread_join(threads[i], &errors);
+      ck_assert_int_eq((uintptr_t) errors, 0);
+    }
+
+    pool_get_stats(&stats);
+    ck_assert_int_eq(stats.in_use, 0);
+    ck_assert_int_le(stats.high_water, TEST_POOL_DEPTH);
+  }
+END_TEST
+
+Suite *pool_suite() {
+  Suite *s = suite_create("pool");
+  TCase *tc = tcase_create("core");
+
+  tcase_add_checked_fixture(tc, pool_setup, pool_teardown);
+  tcase_add_test(tc, test_pool_exhaust);
+  tcase_add_test(tc, test_pool_refs);
+  tcase_add_test(tc, test_pool_threads);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,183 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "test.h"
+#include "speaker_recorder.h"
+#include "speaker_pcm.h"
+
+#define TEST_REC_PORT 12345
+#define TEST_REC_GROUP 0xe00000fb
+#define TEST_REC_QUEUED 12345
+
+static char test_dir[64];
+static char test_file[128];
+
+static const char *test_path(const char *name) {
+  snprintf(test_file, sizeof(test_file), "%s/%s", test_dir, name);
+  return test_file;
+}
+
+static uint32_t test_queued() {
+  return TEST_REC_QUEUED;
+}
+
+static void test_setup() {
+  strcpy(test_dir, "/tmp/castspeaker-test-XXXXXX");
+  ck_assert_ptr_nonnull(mkdtemp(test_dir));
+}
+
+static void test_teardown() {
+  char cmd[96];
+
+  recorder_deinit();
+  recorder_set_queue(NULL);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+  ck_assert_int_eq(system(cmd), 0);
+}
+
+/**
+ * 导出到内存，返回的缓冲区由调用者释放
+ */
+static char *test_export(const char *name, int pcap, size_t *len) {
+  char *buf = NULL;
+  FILE *out = open_memstream(&buf, len);
+
+  ck_assert_int_eq(recorder_export(test_path(name), out, pcap), 0);
+  fclose(out);
+  return buf;
+}
+
+START_TEST(test_recorder_export)
+  {
+    pcm_header_t header = {0};
+    addr_t group = {.type = AF_INET};
+    const uint8_t *p;
+    char *buf;
+    size_t len;
+
+    ck_assert_int_eq(recorder_init(test_path("ring.rec")), 0);
+    group.ipv4.s_addr = htonl(TEST_REC_GROUP);
+    recorder_set_receiver(&group, TEST_REC_PORT);
+    recorder_set_queue(test_queued);
+
+    header.sample.rate = 2;
+    header.sample.bits = 2;
+    header.len = 192;
+    recorder_packet(1, &header, 0, 0, 100, 0x0100007f);
+    recorder_packet(2, &header, 7, 480, 100, 0x0100007f);
+    recorder_event(REC_GAP, 3);
+    ck_assert_int_eq(recorder_dump("dump.rec", NULL, 0), 0);
+
+    buf = test_export("dump.rec", 0, &len);
+    ck_assert_ptr_nonnull(strstr(buf, " v1 seq 0 "));
+    ck_assert_ptr_nonnull(strstr(buf, " queue 12ms\n"));
+    ck_assert_ptr_nonnull(strstr(buf, " v2 seq 7 ts 480 "));
+    ck_assert_ptr_nonnull(strstr(buf, "gap      lost 3 packets"));
+    free(buf);
+
+    // 全局头按本机字节序写入，版本号是两个 16 位字段
+    buf = test_export("dump.rec", 1, &len);
+    ck_assert_uint_eq(*(const uint32_t *) buf, 0xa1b2c3d4);
+    ck_assert_uint_eq(*(const uint16_t *) (buf + 4), 2);
+    ck_assert_uint_eq(*(const uint16_t *) (buf + 6), 4);
+    ck_assert_uint_eq(*(const uint32_t *) (buf + 20), 101);
+
+    // 只导出数据包，包头版本与记录时一致，目的地址和端口为记录的接收地址
+    p = (const uint8_t *) buf + 24;
+    ck_assert_uint_eq(*(const uint32_t *) (p + 8), 28 + PCM_HEADER_SIZE);
+    ck_assert_uint_eq(*(const uint32_t *) (p + 12), 28 + PCM_HEADER_SIZE + 192);
+    ck_assert_uint_eq(pcm_load_be32(p + 16 + 12), 0x7f000001);
+    ck_assert_uint_eq(pcm_load_be32(p + 16 + 16), TEST_REC_GROUP);
+    ck_assert_uint_eq(pcm_load_be16(p + 16 + 20), 0);
+    ck_assert_uint_eq(pcm_load_be16(p + 16 + 22), TEST_REC_PORT);
+    ck_assert_uint_ne(p[16 + 28], PCM_V2_MAGIC);
+
+    p += 16 + 28 + PCM_HEADER_SIZE;
+    ck_assert_uint_eq(*(const uint32_t *) (p + 8), 28 + PCM_V2_HEADER_SIZE);
+    ck_assert_uint_eq(pcm_load_be16(p + 16 + 22), TEST_REC_PORT);
+    ck_assert_uint_eq(p[16 + 28], PCM_V2_MAGIC);
+    ck_assert_uint_eq(pcm_load_be32(p + 16 + 28 + 8), 7);
+    ck_assert_uint_eq(len, (size_t) (p + 16 + 28 + PCM_V2_HEADER_SIZE - (const uint8_t *) buf));
+    free(buf);
+  }
+END_TEST
+
+START_TEST(test_recorder_empty)
+  {
+    char *buf;
+    size_t len;
+
+    ck_assert_int_eq(recorder_init(test_path("ring.rec")), 0);
+    ck_assert_int_eq(recorder_dump("empty.rec", NULL, 0), 0);
+
+    buf = test_export("empty.rec", 0, &len);
+    ck_assert_uint_eq(len, 0);
+    free(buf);
+  }
+END_TEST
+
+START_TEST(test_recorder_dump_name)
+  {
+    char saved[256];
+
+    ck_assert_int_eq(recorder_init(test_path("ring.rec")), 0);
+
+    // 转储文件只能保存在记录文件所在的目录
+    ck_assert_int_eq(recorder_dump("../escape.rec", NULL, 0), -1);
+    ck_assert_int_eq(recorder_dump("/tmp/escape.rec", NULL, 0), -1);
+    ck_assert_int_eq(recorder_dump("..", NULL, 0), -1);
+    ck_assert_int_eq(recorder_dump("", NULL, 0), -1);
+
+    ck_assert_int_eq(recorder_dump(NULL, saved, sizeof(saved)), 0);
+    ck_assert_int_eq(strncmp(saved, test_path("ring.rec."), strlen(test_file)), 0);
+  }
+END_TEST
+
+START_TEST(test_recorder_symlink)
+  {
+    char target[128];
+
+    strcpy(target, test_path("target"));
+    ck_assert_int_eq(symlink(target, test_path("link.rec")), 0);
+
+    // 不跟随符号链接，退回到只在内存中记录
+    ck_assert_int_eq(recorder_init(test_path("link.rec")), 0);
+    ck_assert_int_ne(access(target, F_OK), 0);
+  }
+END_TEST
+
+Suite *recorder_suite() {
+  Suite *s = suite_create("recorder");
+  TCase *tc = tcase_create("core");
+
+  tcase_add_checked_fixture(tc, test_setup, test_teardown);
+  tcase_add_test(tc, test_recorder_export);
+  tcase_add_test(tc, test_recorder_empty);
+  tcase_add_test(tc, test_recorder_dump_name);
+  tcase_add_test(tc, test_recorder_symlink);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,114 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <math.h>
+#include "test.h"
+#include "dsp/resample.h"
+
+#define TEST_RS_CHUNK 480
+#define TEST_RS_CHUNKS 100
+
+/**
+ * 把正弦波分块送入重采样器，返回跳过滤波器建立时间之后输出的 RMS
+ */
+static double resample_tone(uint32_t in_rate, uint32_t out_rate, double hz, size_t *total) {
+  static float in[TEST_RS_CHUNK], out[TEST_RS_CHUNK * 8];
+  float *pin = in, *pout = out;
+  resampler_t *r = resampler_create(in_rate, out_rate, 1, TEST_RS_CHUNK);
+  double sum = 0;
+  size_t i, n, count = 0, t = 0;
+  int c;
+
+  ck_assert_ptr_nonnull(r);
+  ck_assert_int_ge(sizeof(out) / sizeof(float), resampler_max_output(r, TEST_RS_CHUNK));
+
+  for (c = 0; c < TEST_RS_CHUNKS; c++) {
+    for (i = 0; i < TEST_RS_CHUNK; i++, t++) in[i] = (float) sin(2 * M_PI * hz * t / in_rate);
+    n = resampler_process(r, &pout, (const float *const *) &pin, TEST_RS_CHUNK);
+    if (c >= TEST_RS_CHUNKS / 4) {
+      for (i = 0; i < n; i++) sum += (double) out[i] * out[i];
+      count += n;
+    }
+    *total += n;
+  }
+  resampler_destroy(r);
+
+  return sqrt(sum / count);
+}
+
+START_TEST(test_resample_passband)
+  {
+    size_t total = 0;
+    double rms = resample_tone(44100, 48000, 1000, &total);
+
+    ck_assert_double_eq_tol(rms * M_SQRT2, 1.0, 0.01);
+    // 输出帧数与比例一致，相位累加没有漂移
+    ck_assert_int_le(labs((long) total - (long) ((uint64_t) TEST_RS_CHUNK * TEST_RS_CHUNKS * 48000 / 44100)), 1);
+
+    total = 0;
+    rms = resample_tone(44100, 48000, 19000, &total);
+    ck_assert_double_eq_tol(rms * M_SQRT2, 1.0, 0.02);
+  }
+END_TEST
+
+START_TEST(test_resample_stopband)
+  {
+    size_t total = 0;
+    // 降采样时高于输出奈奎斯特频率的成分必须被滤除，否则会混叠到可听频段
+    double rms = resample_tone(96000, 48000, 30000, &total);
+
+    ck_assert_double_lt(20 * log10(rms * M_SQRT2), -80);
+
+    total = 0;
+    rms = resample_tone(192000, 44100, 40000, &total);
+    ck_assert_double_lt(20 * log10(rms * M_SQRT2), -80);
+  }
+END_TEST
+
+START_TEST(test_resample_skip)
+  {
+    static float in[TEST_RS_CHUNK], out[TEST_RS_CHUNK * 2];
+    float *pin = in, *pout = out;
+    resampler_t *a = resampler_create(48000, 44100, 1, TEST_RS_CHUNK);
+    resampler_t *b = resampler_create(48000, 44100, 1, TEST_RS_CHUNK);
+    int c;
+
+    ck_assert_ptr_nonnull(a);
+    ck_assert_ptr_nonnull(b);
+    // 跳过静音和实际处理推进的输出帧数必须一致，否则不同扬声器之间会错位
+    for (c = 0; c < 10; c++) {
+      ck_assert_int_eq(resampler_skip(a, TEST_RS_CHUNK),
+                       resampler_process(b, &pout, (const float *const *) &pin, TEST_RS_CHUNK));
+    }
+    resampler_destroy(a);
+    resampler_destroy(b);
+  }
+END_TEST
+
+Suite *resample_suite() {
+  Suite *s = suite_create("resample");
+  TCase *tc = tcase_create("core");
+
+  tcase_add_test(tc, test_resample_passband);
+  tcase_add_test(tc, test_resample_stopband);
+  tcase_add_test(tc, test_resample_skip);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
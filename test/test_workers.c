@@ -0,0 +1,207 @@
+/**
+    This file is part of castspeaker
+    Copyright (C) 2022-2028  zwcway
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "dsp/workers.h"
+#include "dsp/convolver.h"
+#include "dsp/format.h"
+#include "dsp/resample.h"
+#include "speaker_pipeline.h"
+
+#define TEST_WK_CHANNELS 6
+#define TEST_WK_FRAMES 1024
+#define TEST_WK_TAPS 200
+/* 每包 240 帧 16 位 */
+#define TEST_WK_PACKET_FRAMES 240
+#define TEST_WK_PACKETS 20
+#define TEST_WK_OUT_MAX (TEST_WK_PACKETS * (TEST_WK_PACKET_FRAMES * 160 / 147 + 2) * TEST_WK_CHANNELS * 2)
+
+struct test_job {
+    convolver_t *c;
+    float **buf;
+    uint32_t calls[TEST_WK_CHANNELS];
+};
+
+static void test_channel(void *arg, uint32_t ch) {
+  struct test_job *j = arg;
+
+  // 每个声道只由一个执行者处理，计数不需要原子操作
+  j->calls[ch]++;
+  convolver_process_channel(j->c, ch, j->buf[ch], TEST_WK_FRAMES);
+}
+
+/**
+ * 用同样的输入和滤波器处理 runs 次，结果写入 out
+ */
+static void test_process(float out[TEST_WK_CHANNELS][TEST_WK_FRAMES], int runs, uint32_t calls[TEST_WK_CHANNELS]) {
+  static float h[TEST_WK_TAPS];
+  float *buf[TEST_WK_CHANNELS];
+  struct test_job job = {0};
+  uint32_t ch, i;
+  int r;
+
+  srand(7);
+  for (i = 0; i < TEST_WK_TAPS; i++) h[i] = (float) rand() / RAND_MAX - 0.5f;
+  job.c = convolver_create(h, TEST_WK_TAPS, CONVOLVER_BLOCK, TEST_WK_CHANNELS);
+  ck_assert_ptr_nonnull(job.c);
+  job.buf = buf;
+
+  for (r = 0; r < runs; r++) {
+    for (ch = 0; ch < TEST_WK_CHANNELS; ch++) {
+      buf[ch] = out[ch];
+      for (i = 0; i < TEST_WK_FRAMES; i++) out[ch][i] = (float) rand() / RAND_MAX - 0.5f;
+    }
+    workers_run(test_channel, &job, TEST_WK_CHANNELS);
+  }
+  convolver_destroy(job.c);
+  memcpy(calls, job.calls, sizeof(job.calls));
+}
+
+START_TEST(test_workers_match_inline)
+  {
+    static float inline_out[TEST_WK_CHANNELS][TEST_WK_FRAMES], pooled_out[TEST_WK_CHANNELS][TEST_WK_FRAMES];
+    uint32_t calls[TEST_WK_CHANNELS], ch;
+
+    ck_assert_int_eq(workers_init(WORKERS_INLINE, TEST_WK_CHANNELS), 0);
+    ck_assert_uint_eq(workers_count(), 0);
+    test_process(inline_out, 20, calls);
+
+    ck_assert_int_eq(workers_init(2, TEST_WK_CHANNELS), 0);
+    ck_assert_uint_eq(workers_count(), 2);
+    test_process(pooled_out, 20, calls);
+    workers_deinit();
+
+    // 声道之间互不影响，工作线程的结果必须与单线程逐位相同
+    ck_assert_mem_eq(inline_out, pooled_out, sizeof(inline_out));
+    for (ch = 0; ch < TEST_WK_CHANNELS; ch++) ck_assert_uint_eq(calls[ch], 20);
+  }
+END_TEST
+
+START_TEST(test_workers_limits)
+  {
+    // 没有声道或者只有一个声道时不创建线程
+    ck_assert_int_eq(workers_init(0, 0), 0);
+    ck_assert_uint_eq(workers_count(), 0);
+    ck_assert_int_eq(workers_init(4, 1), 0);
+    ck_assert_uint_eq(workers_count(), 0);
+
+    // 线程数不超过声道数减一
+    ck_assert_int_eq(workers_init(WORKERS_MAX, 3), 0);
+    ck_assert_uint_eq(workers_count(), 2);
+    workers_deinit();
+    ck_assert_uint_eq(workers_count(), 0);
+  }
+END_TEST
+
+static uint8_t test_out[TEST_WK_OUT_MAX];
+static size_t test_out_len;
+
+static int test_output(pcm_header_t *header, const uint8_t *data) {
+  ck_assert_uint_eq(header->sample.rate, RATE_48000);
+  ck_assert_uint_le(test_out_len + header->len, sizeof(test_out));
+  memcpy(test_out + test_out_len, data, header->len);
+  test_out_len += header->len;
+  return 0;
+}
+
+/**
+ * 44.1kHz 送入输出为 48kHz 的 pipeline，返回输出的字节数
+ */
+static size_t test_pipeline(int16_t *in, uint32_t workers, uint32_t *threads) {
+  struct pipeline_config cfg = {
+    .output_cb = test_output,
+    .out_rate = 48000,
+    .channels = TEST_WK_CHANNELS,
+    .mtu = TEST_WK_PACKET_FRAMES * TEST_WK_CHANNELS * 2,
+    .workers = workers,
+  };
+  pcm_header_t header = {0};
+  int i;
+
+  test_out_len = 0;
+  ck_assert_int_eq(pipeline_init(&cfg), 0);
+  *threads = workers_count();
+
+  header.sample.rate = RATE_44100;
+  header.sample.bits = BIT_16;
+  header.len = TEST_WK_PACKET_FRAMES * TEST_WK_CHANNELS * 2;
+  for (i = 0; i < TEST_WK_PACKETS; i++) {
+    ck_assert_int_eq(pipeline_send(&header, (const uint8_t *) (in + i * TEST_WK_PACKET_FRAMES * TEST_WK_CHANNELS)), 0);
+  }
+  pipeline_deinit();
+
+  return test_out_len;
+}
+
+START_TEST(test_workers_pipeline_resample)
+  {
+    static int16_t in[TEST_WK_PACKETS * TEST_WK_PACKET_FRAMES * TEST_WK_CHANNELS];
+    static uint8_t inline_out[TEST_WK_OUT_MAX], ref_out[TEST_WK_OUT_MAX];
+    static float fin[TEST_WK_CHANNELS][TEST_WK_PACKET_FRAMES], fout[TEST_WK_CHANNELS][TEST_WK_PACKET_FRAMES * 2];
+    float *pin[TEST_WK_CHANNELS], *pout[TEST_WK_CHANNELS];
+    size_t inline_len, ref_len = 0, n, i;
+    uint32_t threads, ch;
+    resampler_t *r;
+
+    srand(11);
+    for (i = 0; i < sizeof(in) / sizeof(in[0]); i++) in[i] = (int16_t) (rand() % 20000 - 10000);
+
+    inline_len = test_pipeline(in, WORKERS_INLINE, &threads);
+    ck_assert_uint_eq(threads, 0);
+    memcpy(inline_out, test_out, inline_len);
+
+    // 每个声道的解码、重采样和编码都在工作线程中完成
+    ck_assert_uint_eq(test_pipeline(in, 3, &threads), inline_len);
+    ck_assert_uint_eq(threads, 3);
+    ck_assert_mem_eq(inline_out, test_out, inline_len);
+
+    // 与逐块整体重采样的结果一致
+    r = resampler_create(44100, 48000, TEST_WK_CHANNELS, TEST_WK_PACKET_FRAMES);
+    ck_assert_ptr_nonnull(r);
+    for (ch = 0; ch < TEST_WK_CHANNELS; ch++) {
+      pin[ch] = fin[ch];
+      pout[ch] = fout[ch];
+    }
+    for (i = 0; i < TEST_WK_PACKETS; i++) {
+      pcm_to_float(pin, (const uint8_t *) (in + i * TEST_WK_PACKET_FRAMES * TEST_WK_CHANNELS), TEST_WK_PACKET_FRAMES,
+                   TEST_WK_CHANNELS, 16);
+      n = resampler_process(r, pout, (const float *const *) pin, TEST_WK_PACKET_FRAMES);
+      float_to_pcm(ref_out + ref_len, (const float *const *) pout, n, TEST_WK_CHANNELS, 16);
+      ref_len += n * TEST_WK_CHANNELS * 2;
+    }
+    resampler_destroy(r);
+    ck_assert_uint_eq(ref_len, inline_len);
+    ck_assert_mem_eq(ref_out, inline_out, ref_len);
+  }
+END_TEST
+
+Suite *workers_suite() {
+  Suite *s = suite_create("workers");
+  TCase *tc = tcase_create("core");
+
+  tcase_add_test(tc, test_workers_match_inline);
+  tcase_add_test(tc, test_workers_limits);
+  tcase_add_test(tc, test_workers_pipeline_resample);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
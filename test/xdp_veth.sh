@@ -0,0 +1,132 @@
+#!/bin/bash
+#
+#    This file is part of castspeaker
+#    Copyright (C) 2022-2028  zwcway
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# 在 veth + network namespace 上测试 AF_XDP 接收路径和回退到普通 socket 的路径。
+# 用法: xdp_veth.sh <castspeaker> <xdp_kern.o>
+# 需要 root、iproute2、ss 和 nc，条件不满足时返回 77（ctest 记为跳过）
+
+set -u
+
+SPEAKER=${1:-./castspeaker}
+PROG=${2:-./xdp_kern.o}
+NS=cs-xdp-src
+DEV=cs-xdp0
+PEER=cs-xdp1
+HOST_IP=10.77.0.1
+PEER_IP=10.77.0.2
+MCAST_PORT=14414
+SOCK=/tmp/castspeaker.sock
+COUNT=200
+
+skip() {
+  echo "SKIP: $*"
+  exit 77
+}
+
+fail() {
+  echo "FAIL: $*"
+  [ -f "$WORK/speaker.log" ] && tail -n 20 "$WORK/speaker.log"
+  exit 1
+}
+
+[ "$(id -u)" = 0 ] || skip "need root"
+for tool in ip ss nc; do
+  command -v $tool >/dev/null || skip "$tool not found"
+done
+[ -x "$SPEAKER" ] || skip "$SPEAKER not found"
+[ -f "$PROG" ] || skip "$PROG not found"
+
+WORK=$(mktemp -d)
+PID=
+
+cleanup() {
+  [ -n "$PID" ] && kill "$PID" 2>/dev/null && wait "$PID" 2>/dev/null
+  ip netns del $NS 2>/dev/null
+  ip link del $DEV 2>/dev/null
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+ip netns add $NS || skip "can not create netns"
+ip link add $DEV type veth peer name $PEER || skip "can not create veth"
+ip link set $PEER netns $NS
+ip addr add $HOST_IP/24 dev $DEV
+ip link set $DEV up
+ip netns exec $NS ip addr add $PEER_IP/24 dev $PEER
+ip netns exec $NS ip link set $PEER up
+ip netns exec $NS ip link set lo up
+# veth 的 native XDP 要求对端也挂载 XDP 程序，对端的 port_map 为空，所有包直接放行
+ip netns exec $NS ip link set dev $PEER xdp obj "$PROG" sec xdp 2>/dev/null
+
+# 启动扬声器，等待状态接口就绪，输出数据端口
+start_speaker() {
+  cp "$PROG" "$WORK/xdp_kern.o"
+  (cd "$WORK" && exec "$SPEAKER" -i $DEV -p $MCAST_PORT -o raw -D none -l debug "$@" >"$WORK/speaker.log" 2>&1) &
+  PID=$!
+
+  for _ in $(seq 50); do
+    [ -S $SOCK ] && ss -Huanp 2>/dev/null | grep -q "pid=$PID," && break
+    sleep 0.1
+  done
+  kill -0 $PID 2>/dev/null || fail "speaker exited"
+
+  DATA_PORT=$(ss -Huanp | grep "pid=$PID," | awk '{print $4}' | sed 's/.*://' | grep -v "^$MCAST_PORT$" | head -n 1)
+  [ -n "$DATA_PORT" ] || fail "data port not found"
+}
+
+stop_speaker() {
+  kill $PID 2>/dev/null
+  wait $PID 2>/dev/null
+  PID=
+}
+
+# 从 namespace 中向数据端口发送 COUNT 个包，负载不是合法的 PCM 包，由接收端丢弃并记录
+send_packets() {
+  ip netns exec $NS bash -c "for i in \$(seq $COUNT); do printf 'castspeaker-xdp-test-%04d' \$i > /dev/udp/$HOST_IP/$DATA_PORT; done"
+  sleep 0.5
+}
+
+status() {
+  echo status | nc -U -w 1 $SOCK
+}
+
+received() {
+  grep -c "receiver recvfrom fail" "$WORK/speaker.log"
+}
+
+echo "== AF_XDP on $DEV"
+start_speaker -X $DEV:0
+grep -q "xdp on $DEV" "$WORK/speaker.log" || fail "AF_XDP not attached"
+send_packets
+STATUS=$(status)
+XDP_PACKETS=$(echo "$STATUS" | sed -n 's/^xdp packets \([0-9]*\).*/\1/p')
+echo "$STATUS" | grep "^xdp"
+[ -n "$XDP_PACKETS" ] || fail "no xdp statistics"
+[ "$XDP_PACKETS" -ge $COUNT ] || fail "xdp received $XDP_PACKETS of $COUNT packets"
+[ "$(received)" -ge $COUNT ] || fail "receiver handled $(received) of $COUNT packets"
+stop_speaker
+
+echo "== fallback to socket"
+start_speaker -X cs-xdp-none:0
+grep -q "AF_XDP unavailable" "$WORK/speaker.log" || fail "no fallback warning"
+send_packets
+status | grep -q "^xdp" && fail "xdp statistics without AF_XDP"
+[ "$(received)" -ge $COUNT ] || fail "socket received $(received) of $COUNT packets"
+stop_speaker
+
+echo "PASS"